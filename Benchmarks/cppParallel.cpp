@@ -6,6 +6,9 @@
 #include <chrono>
 #include <thread>
 #include <execution>
+#include <mutex>
+
+#include "perfCounters.h"
 
 struct Point {
   double x; // meters
@@ -39,6 +42,39 @@ const double kineticFriction = 0.3;
 const double dt = 0.0001;
 const double dampening = 1 - (dt * 5);
 const double gravity = -9.81;
+const bool collectPerfCounters = false; // cycles, instructions and cache misses per phase - Linux only
+
+// Counters are per thread so every worker opens its own set the first time it runs a phase
+std::mutex counterMutex;
+std::vector<PerfCounters *> springCounterSets;
+std::vector<PerfCounters *> pointCounterSets;
+thread_local PerfCounters *springCounters = NULL;
+thread_local PerfCounters *pointCounters = NULL;
+
+PerfCounters *threadCounters(PerfCounters *&counters, std::vector<PerfCounters *> &sets) {
+    if (counters == NULL) {
+        counters = new PerfCounters(openPerfCounters());
+        std::lock_guard<std::mutex> lock(counterMutex);
+        sets.push_back(counters);
+    }
+    return counters;
+}
+
+PerfCounters mergePerfCounters(std::vector<PerfCounters *> &sets) {
+    PerfCounters merged = {};
+    for (int i = 0; i < numPerfCounters; i++) {
+        merged.fds[i] = -1;
+    }
+    for (auto it = sets.begin(); it != sets.end(); ++it) {
+        for (int i = 0; i < numPerfCounters; i++) {
+            if ((*it)->fds[i] >= 0) {
+                merged.fds[i] = (*it)->fds[i]; // only marks it available for printing
+                merged.totals[i] += (*it)->totals[i];
+            }
+        }
+    }
+    return merged;
+}
 
 void updateSprings(std::vector<Point> &points, std::vector<Spring> &springs, double adjust, int start, int end) {
     for (int i = start; i < end; i++) {
@@ -209,10 +245,24 @@ int main() {
     while (t < limit) {
         double adjust = 1 + sin(t * kOscillationFrequency) * 0.1;
         std::for_each(std::execution::par, std::begin(springSplits), std::end(springSplits), [&](auto pair) {
+            PerfCounters *counters = collectPerfCounters ? threadCounters(springCounters, springCounterSets) : NULL;
+            if (counters != NULL) {
+                startPerfCounters(*counters);
+            }
             updateSprings(points, springs, adjust, pair.first, pair.second);
+            if (counters != NULL) {
+                stopPerfCounters(*counters);
+            }
         });
         std::for_each(std::execution::par, std::begin(pointSplits), std::end(pointSplits), [&](auto pair) {
+            PerfCounters *counters = collectPerfCounters ? threadCounters(pointCounters, pointCounterSets) : NULL;
+            if (counters != NULL) {
+                startPerfCounters(*counters);
+            }
             updatePoints(points, springs, pointSprings, pair.first, pair.second);
+            if (counters != NULL) {
+                stopPerfCounters(*counters);
+            }
         });
         t += dt;
     }
@@ -221,6 +271,14 @@ int main() {
     auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - begin);
     std::cout << "Time difference = " << ms.count() / 1000.0 << "[s]" << std::endl;
     printf("p[0].y = %f, x = %f, z = %f\n", points[0].y, points[0].x, points[0].z);
+    if (collectPerfCounters) {
+        // Summed over every worker - reading the counters costs syscalls so the time above is a bit inflated
+        const long long numSteps = (long long) ceil(limit / dt);
+        PerfCounters springTotals = mergePerfCounters(springCounterSets);
+        PerfCounters pointTotals = mergePerfCounters(pointCounterSets);
+        printPerfCounters("springs", springTotals, numSteps * numSprings, "spring update");
+        printPerfCounters("points", pointTotals, numSteps * (long long) points.size(), "point update");
+    }
 
     return 0;
 }
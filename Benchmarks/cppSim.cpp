@@ -14,6 +14,7 @@ const double kineticFriction = 0.3;
 const double dt = 0.0001;
 const double dampening = 1 - (dt * 5);
 const double gravity = -9.81;
+const bool collectPerfCounters = false; // cycles, instructions and cache misses per phase - Linux only
 
 int mains() {
     std::vector<Point> points;
@@ -76,13 +77,27 @@ int mains() {
     std::vector<FlexPreset> presets = { {1, 0.0, 0.0} };
     long long int y = (long long int)(limit / dt * numSprings);
     printf("num springs evaluated: %lld\n", y);
+    PerfCounters springCounters = openPerfCounters();
+    PerfCounters pointCounters = openPerfCounters();
     std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
 
-    simulate(points, springs, presets, limit, 0);
+    if (collectPerfCounters) {
+        simulate(points, springs, presets, limit, 0, &springCounters, &pointCounters);
+    } else {
+        simulate(points, springs, presets, limit, 0);
+    }
 
     std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
     auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - begin);
     std::cout << "Time difference = " << ms.count() / 1000.0 << "[s]" << std::endl;
+    if (collectPerfCounters) {
+        // Reading the counters twice a step costs syscalls so the time above is a bit inflated
+        const long long numSteps = (long long) ceil(limit / dt);
+        printPerfCounters("springs", springCounters, numSteps * numSprings, "spring update");
+        printPerfCounters("points", pointCounters, numSteps * (long long) points.size(), "point update");
+    }
+    closePerfCounters(springCounters);
+    closePerfCounters(pointCounters);
     for (int i = 0; i < 8; i++) {
         printf("p[%d].x = %f, y = %f, z = %f\n", i, points[i].x, points[i].y, points[i].z);
     }
@@ -90,7 +105,7 @@ int mains() {
     return 0;
 }
 
-void simulate(std::vector<Point> &points, std::vector<Spring> &springs, std::vector<FlexPreset> presets, double n, double oscillationFrequency) {
+void simulate(std::vector<Point> &points, std::vector<Spring> &springs, std::vector<FlexPreset> presets, double n, double oscillationFrequency, PerfCounters *springCounters, PerfCounters *pointCounters) {
     double t = 0;
     std::vector<double> presetValues;
     for (auto it = presets.begin(); it != presets.end(); it++) {
@@ -103,6 +118,9 @@ void simulate(std::vector<Point> &points, std::vector<Spring> &springs, std::vec
             const double c = presets[i].c; 
             presetValues[i] = a + b * sin(t * oscillationFrequency);
         }
+        if (springCounters != NULL) {
+            startPerfCounters(*springCounters);
+        }
         for (std::vector<Spring>::iterator i = springs.begin(); i != springs.end(); ++i) {
             Spring l = *i;
 
@@ -133,6 +151,12 @@ void simulate(std::vector<Point> &points, std::vector<Spring> &springs, std::vec
             points[p1index].fz -= dz;
             points[p2index].fz += dz;
         }
+        if (springCounters != NULL) {
+            stopPerfCounters(*springCounters);
+        }
+        if (pointCounters != NULL) {
+            startPerfCounters(*pointCounters);
+        }
         for (std::vector<Point>::iterator i = points.begin(); i != points.end(); ++i) {
             Point p = *i;
         
@@ -176,6 +200,9 @@ void simulate(std::vector<Point> &points, std::vector<Spring> &springs, std::vec
             p.z += vz * dt;
             *i = p;
         }
+        if (pointCounters != NULL) {
+            stopPerfCounters(*pointCounters);
+        }
         t += dt;
     }
 }
@@ -2,6 +2,7 @@
 #define CPP_SIM_H
 
 #include <vector>
+#include "perfCounters.h"
 
 struct Point {
   double x; // meters
@@ -30,7 +31,8 @@ struct FlexPreset {
     const double c;
 };
 
-// Updates the x, y, and z values of the points after running a simulation for n seconds
-void simulate(std::vector<Point> &points, std::vector<Spring> &springs, std::vector<FlexPreset> presets, double n, double oscillationFrequency);
+// Updates the x, y, and z values of the points after running a simulation for n seconds.
+// Counters, if given, are totalled over just the spring and point loops
+void simulate(std::vector<Point> &points, std::vector<Spring> &springs, std::vector<FlexPreset> presets, double n, double oscillationFrequency, PerfCounters *springCounters = NULL, PerfCounters *pointCounters = NULL);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,132 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+// Hardware counters around a phase of the benchmarks - Linux perf_event_open only, everywhere else (or without
+// permission - see /proc/sys/kernel/perf_event_paranoid) they just report as unavailable.
+// Counters are per thread so open one set on each thread doing the work and merge the totals.
+
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+enum PerfCounterKind {
+    cyclesCounter,
+    instructionsCounter,
+    l1MissesCounter, // L1 data cache read misses
+    llcMissesCounter, // last level cache misses
+    branchMissesCounter,
+    numPerfCounters,
+};
+
+const char *const kPerfCounterNames[numPerfCounters] = {"cycles", "instructions", "L1d misses", "LLC misses", "branch misses"};
+
+struct PerfCounters {
+    int fds[numPerfCounters]; // -1 if that counter couldn't be opened
+    long long starts[numPerfCounters];
+    long long totals[numPerfCounters];
+};
+
+#if defined(__linux__)
+
+inline int openPerfCounter(unsigned int type, unsigned long long config) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0); // this thread, any cpu
+}
+
+inline long long readPerfCounter(int fd) {
+    long long value = 0;
+    if (fd < 0 || read(fd, &value, sizeof(value)) != sizeof(value)) {
+        return 0;
+    }
+    return value;
+}
+
+#endif
+
+// Counting starts straight away - startPerfCounters/stopPerfCounters bracket the bits that get totalled
+inline PerfCounters openPerfCounters() {
+    PerfCounters counters;
+    for (int i = 0; i < numPerfCounters; i++) {
+        counters.fds[i] = -1;
+        counters.starts[i] = 0;
+        counters.totals[i] = 0;
+    }
+#if defined(__linux__)
+    const unsigned long long l1ReadMiss = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    counters.fds[cyclesCounter] = openPerfCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    counters.fds[instructionsCounter] = openPerfCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    counters.fds[l1MissesCounter] = openPerfCounter(PERF_TYPE_HW_CACHE, l1ReadMiss);
+    counters.fds[llcMissesCounter] = openPerfCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    counters.fds[branchMissesCounter] = openPerfCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+#endif
+    return counters;
+}
+
+inline bool perfCountersAvailable(PerfCounters &counters) {
+    for (int i = 0; i < numPerfCounters; i++) {
+        if (counters.fds[i] >= 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline void startPerfCounters(PerfCounters &counters) {
+#if defined(__linux__)
+    for (int i = 0; i < numPerfCounters; i++) {
+        counters.starts[i] = readPerfCounter(counters.fds[i]);
+    }
+#endif
+}
+
+inline void stopPerfCounters(PerfCounters &counters) {
+#if defined(__linux__)
+    for (int i = 0; i < numPerfCounters; i++) {
+        counters.totals[i] += readPerfCounter(counters.fds[i]) - counters.starts[i];
+    }
+#endif
+}
+
+inline void closePerfCounters(PerfCounters &counters) {
+#if defined(__linux__)
+    for (int i = 0; i < numPerfCounters; i++) {
+        if (counters.fds[i] >= 0) {
+            close(counters.fds[i]);
+            counters.fds[i] = -1;
+        }
+    }
+#endif
+}
+
+// Totals plus per-unit rates - units is whatever the phase updates once per step (springs or points)
+inline void printPerfCounters(const char *phase, PerfCounters &counters, long long units, const char *unitName) {
+    if (!perfCountersAvailable(counters)) {
+        printf("%s: hardware counters unavailable\n", phase);
+        return;
+    }
+    printf("%s:\n", phase);
+    for (int i = 0; i < numPerfCounters; i++) {
+        if (counters.fds[i] < 0) {
+            printf("  %-14s unavailable\n", kPerfCounterNames[i]);
+            continue;
+        }
+        printf("  %-14s %16lld  %10.3f per %s\n", kPerfCounterNames[i], counters.totals[i], (double) counters.totals[i] / units, unitName);
+    }
+    if (counters.fds[cyclesCounter] >= 0 && counters.fds[instructionsCounter] >= 0 && counters.totals[cyclesCounter] > 0) {
+        printf("  IPC            %16.3f\n", (double) counters.totals[instructionsCounter] / counters.totals[cyclesCounter]);
+    }
+}
+
+#endif
@@ -0,0 +1,298 @@
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../VSOoze/OozebotEncoding.h"
+
+// Usage: nvcc -O2 scaling.cpp -o scaling ../VSOoze/cudaSim.cu ../VSOoze/cppSim.cpp ../VSOoze/OozebotEncoding.cpp ../VSOoze/latticeSim.cpp ../VSOoze/Metrics.cpp ../VSOoze/Trace.cpp ../VSOoze/Arena.cpp ../VSOoze/SimBackend.cpp ../VSOoze/Numa.cpp
+// Sweeps thread counts over the real cpu engine and writes scaling.csv and scaling.json:
+// - population: many robots at once, one per thread (what evoAlgo does)
+// - intra: one big robot split across a thread team (IntraRobotThreading)
+// Strong scaling keeps the work fixed as threads are added, weak scaling grows it with them.
+// Efficiency is throughput / (threads * single thread throughput). Saturation compares the traffic the robot would
+// need if it streamed from memory every step against a triad measured with the same number of threads - it only
+// means something once the working set is well past the last level cache
+
+const double kSimSeconds = 0.1; // simulated per robot
+const int kGenomeCorpusSize = 32;
+const int kStrongPopulationRobots = 32;
+const int kWeakRobotsPerThread = 4;
+const int kPopulationCubeSide = 8;
+const int kIntraCubeSides[] = {16, 22, 30};
+const int kWeakIntraCubeSide = 16; // for one thread - grows with the cube root of the thread count
+const size_t kTriadLength = 1 << 23; // doubles per array - 64MB each
+
+struct Robot {
+    std::string name;
+    std::vector<Point> points;
+    std::vector<Spring> springs;
+    CompactSprings compact;
+    std::vector<FlexPreset> presets;
+    float oscillationFrequency;
+};
+
+struct ScalingResult {
+    std::string mode;
+    std::string scaling;
+    std::string workload;
+    int threads;
+    int robots;
+    long long points;
+    long long springs;
+    double seconds;
+    double springStepsPerSecond;
+    double efficiency;
+    double workingSetBytes; // largest single robot
+    double estimatedBandwidth; // bytes/second if every step streamed the working set
+    double triadBandwidth;
+};
+
+Robot cubeRobot(int side) {
+    Robot robot;
+    robot.name = "cube" + std::to_string(side);
+    for (int x = 0; x < side; x++) {
+        for (int y = 0; y < side; y++) {
+            for (int z = 0; z < side; z++) {
+                robot.points.push_back({x * 0.1f, y * 0.1f, z * 0.1f, 0, 0, 0, 0.1f, 0.5f, 0.8f, 0, 0, 0, 0, 0});
+            }
+        }
+    }
+    auto index = [&](int x, int y, int z) { return (x * side + y) * side + z; };
+    for (int x = 0; x < side; x++) {
+        for (int y = 0; y < side; y++) {
+            for (int z = 0; z < side; z++) {
+                for (int dx = 0; dx <= 1; dx++) {
+                    for (int dy = -1; dy <= 1; dy++) {
+                        for (int dz = -1; dz <= 1; dz++) {
+                            if (dx == 0 && (dy < 0 || (dy == 0 && dz <= 0))) {
+                                continue; // each pair once
+                            }
+                            const int x1 = x + dx, y1 = y + dy, z1 = z + dz;
+                            if (x1 >= side || y1 < 0 || y1 >= side || z1 < 0 || z1 >= side) {
+                                continue;
+                            }
+                            const int p1 = index(x, y, z);
+                            const int p2 = index(x1, y1, z1);
+                            const float length = 0.1f * sqrtf((float) (dx * dx + dy * dy + dz * dz));
+                            robot.springs.push_back({1000.0f, p1, p2, length, robot.points[p1].numSprings, robot.points[p2].numSprings, (x + y) % 2});
+                            robot.points[p1].numSprings += 1;
+                            robot.points[p2].numSprings += 1;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    robot.presets.push_back({1, 0.1f, 0});
+    robot.presets.push_back({1, 0.1f, 1});
+    robot.oscillationFrequency = 10;
+    robot.compact = compactSprings(robot.springs);
+    return robot;
+}
+
+Robot genomeRobot(OozebotEncoding &encoding) {
+    SimInputs inputs = OozebotEncoding::inputsFromEncoding(encoding);
+    Robot robot = {"genome", inputs.points, inputs.springs, compactSprings(inputs.springs), inputs.springPresets, (float) encoding.globalTimeInterval};
+    return robot;
+}
+
+long long stepsPerRobot() {
+    return (long long) ceil(kSimSeconds / kDefaultSimOptions.dt);
+}
+
+double workingSetBytes(const Robot &robot) {
+    return (double) robot.points.size() * sizeof(Point) + (double) robot.compact.springs.size() * sizeof(CompactSpring);
+}
+
+// Best of a few a[i] = b[i] + s * c[i] passes split across threads - 24 bytes of traffic per element
+double triadBandwidth(int numThreads) {
+    std::vector<double> a(kTriadLength, 0), b(kTriadLength, 1), c(kTriadLength, 2);
+    double best = 0;
+    for (int pass = 0; pass < 5; pass++) {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (int t = 0; t < numThreads; t++) {
+            threads.push_back(std::thread([&, t]() {
+                const size_t begin = kTriadLength * t / numThreads;
+                const size_t end = kTriadLength * (t + 1) / numThreads;
+                for (size_t i = begin; i < end; i++) {
+                    a[i] = b[i] + 3.0 * c[i];
+                }
+            }));
+        }
+        for (auto it = threads.begin(); it != threads.end(); ++it) {
+            (*it).join();
+        }
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        best = std::max(best, 24.0 * kTriadLength / seconds);
+    }
+    return best;
+}
+
+// Every robot gets simulated once from its starting state - threads pull the next one off a shared counter
+ScalingResult runPopulation(std::vector<Robot *> &robots, int numThreads) {
+    configureIntraRobotThreading({1 << 30, 1, 0});
+    std::atomic<int> next(0);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < numThreads; t++) {
+        threads.push_back(std::thread([&]() {
+            int i;
+            while ((i = next.fetch_add(1)) < robots.size()) {
+                Robot &robot = *robots[i];
+                std::vector<Point> points = robot.points;
+                simulateCompactCPP(points, robot.compact, robot.presets, kSimSeconds, 0, robot.oscillationFrequency);
+            }
+        }));
+    }
+    for (auto it = threads.begin(); it != threads.end(); ++it) {
+        (*it).join();
+    }
+    ScalingResult result = {};
+    result.mode = "population";
+    result.threads = numThreads;
+    result.robots = (int) robots.size();
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double streamedBytes = 0;
+    for (auto it = robots.begin(); it != robots.end(); ++it) {
+        result.points += (*it)->points.size();
+        result.springs += (*it)->springs.size();
+        result.workingSetBytes = std::max(result.workingSetBytes, workingSetBytes(**it));
+        streamedBytes += workingSetBytes(**it) * stepsPerRobot();
+    }
+    result.springStepsPerSecond = result.springs * stepsPerRobot() / result.seconds;
+    result.estimatedBandwidth = streamedBytes / result.seconds;
+    return result;
+}
+
+ScalingResult runIntra(Robot &robot, int numThreads) {
+    configureIntraRobotThreading({0, numThreads, numThreads - 1});
+    std::vector<Point> points = robot.points;
+    auto start = std::chrono::steady_clock::now();
+    simulateCompactCPP(points, robot.compact, robot.presets, kSimSeconds, 0, robot.oscillationFrequency);
+    ScalingResult result = {};
+    result.mode = "intra";
+    result.workload = robot.name;
+    result.threads = numThreads;
+    result.robots = 1;
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.points = robot.points.size();
+    result.springs = robot.springs.size();
+    result.workingSetBytes = workingSetBytes(robot);
+    result.springStepsPerSecond = result.springs * stepsPerRobot() / result.seconds;
+    result.estimatedBandwidth = result.workingSetBytes * stepsPerRobot() / result.seconds;
+    return result;
+}
+
+void report(std::vector<ScalingResult> &results, ScalingResult result, double singleThreadThroughput, double triad) {
+    result.efficiency = result.springStepsPerSecond / (result.threads * singleThreadThroughput);
+    result.triadBandwidth = triad;
+    printf("%-10s %-6s %-8s threads %3d robots %4d springs %9lld  %8.3fs  %10.4g spring-steps/s  efficiency %.2f  saturation %.2f\n",
+        result.mode.c_str(), result.scaling.c_str(), result.workload.c_str(), result.threads, result.robots, result.springs,
+        result.seconds, result.springStepsPerSecond, result.efficiency, result.estimatedBandwidth / triad);
+    results.push_back(result);
+}
+
+void writeResults(std::vector<ScalingResult> &results) {
+    std::ofstream csv("scaling.csv");
+    csv << "mode,scaling,workload,threads,robots,points,springs,seconds,spring_steps_per_second,efficiency,working_set_bytes,estimated_bandwidth,triad_bandwidth,saturation\n";
+    std::ofstream json("scaling.json");
+    json << "[\n";
+    char line[1024];
+    for (int i = 0; i < results.size(); i++) {
+        ScalingResult &r = results[i];
+        const double saturation = r.estimatedBandwidth / r.triadBandwidth;
+        snprintf(line, sizeof(line), "%s,%s,%s,%d,%d,%lld,%lld,%.6f,%.6g,%.4f,%.0f,%.6g,%.6g,%.4f\n",
+            r.mode.c_str(), r.scaling.c_str(), r.workload.c_str(), r.threads, r.robots, r.points, r.springs, r.seconds,
+            r.springStepsPerSecond, r.efficiency, r.workingSetBytes, r.estimatedBandwidth, r.triadBandwidth, saturation);
+        csv << line;
+        snprintf(line, sizeof(line), "  {\"mode\": \"%s\", \"scaling\": \"%s\", \"workload\": \"%s\", \"threads\": %d, \"robots\": %d, \"points\": %lld, \"springs\": %lld, \"seconds\": %.6f, \"spring_steps_per_second\": %.6g, \"efficiency\": %.4f, \"working_set_bytes\": %.0f, \"estimated_bandwidth\": %.6g, \"triad_bandwidth\": %.6g, \"saturation\": %.4f}%s\n",
+            r.mode.c_str(), r.scaling.c_str(), r.workload.c_str(), r.threads, r.robots, r.points, r.springs, r.seconds,
+            r.springStepsPerSecond, r.efficiency, r.workingSetBytes, r.estimatedBandwidth, r.triadBandwidth, saturation, i + 1 < results.size() ? "," : "");
+        json << line;
+    }
+    json << "]\n";
+}
+
+int main() {
+    const int maxThreads = std::max(1, (int) std::thread::hardware_concurrency());
+    std::vector<int> threadCounts;
+    for (int t = 1; t < maxThreads; t *= 2) {
+        threadCounts.push_back(t);
+    }
+    threadCounts.push_back(maxThreads);
+
+    std::vector<double> triad;
+    for (auto it = threadCounts.begin(); it != threadCounts.end(); ++it) {
+        triad.push_back(triadBandwidth(*it));
+        printf("triad with %d threads: %.2f GB/s\n", *it, triad.back() / 1e9);
+    }
+
+    // Built once so every thread count sees the same robots
+    std::vector<Robot> genomeCorpus;
+    for (int i = 0; i < kGenomeCorpusSize; i++) {
+        OozebotEncoding encoding = OozebotEncoding::randomEncoding();
+        genomeCorpus.push_back(genomeRobot(encoding));
+    }
+    Robot populationCube = cubeRobot(kPopulationCubeSide);
+
+    std::vector<ScalingResult> results;
+
+    // Population level - genomes and a small cube
+    for (int workload = 0; workload < 2; workload++) {
+        const char *name = workload == 0 ? "genome" : populationCube.name.c_str();
+        double strongBase = 0;
+        double weakBase = 0;
+        for (int i = 0; i < threadCounts.size(); i++) {
+            const int numThreads = threadCounts[i];
+            std::vector<Robot *> strong;
+            for (int r = 0; r < kStrongPopulationRobots; r++) {
+                strong.push_back(workload == 0 ? &genomeCorpus[r % genomeCorpus.size()] : &populationCube);
+            }
+            ScalingResult result = runPopulation(strong, numThreads);
+            result.scaling = "strong";
+            result.workload = name;
+            strongBase = i == 0 ? result.springStepsPerSecond : strongBase;
+            report(results, result, strongBase, triad[i]);
+
+            std::vector<Robot *> weak;
+            for (int r = 0; r < kWeakRobotsPerThread * numThreads; r++) {
+                weak.push_back(workload == 0 ? &genomeCorpus[r % genomeCorpus.size()] : &populationCube);
+            }
+            result = runPopulation(weak, numThreads);
+            result.scaling = "weak";
+            result.workload = name;
+            weakBase = i == 0 ? result.springStepsPerSecond : weakBase;
+            report(results, result, weakBase, triad[i]);
+        }
+    }
+
+    // Intra robot - one big cube per run
+    for (int side : kIntraCubeSides) {
+        Robot cube = cubeRobot(side);
+        double base = 0;
+        for (int i = 0; i < threadCounts.size(); i++) {
+            ScalingResult result = runIntra(cube, threadCounts[i]);
+            result.scaling = "strong";
+            base = i == 0 ? result.springStepsPerSecond : base;
+            report(results, result, base, triad[i]);
+        }
+    }
+    double weakBase = 0;
+    for (int i = 0; i < threadCounts.size(); i++) {
+        Robot cube = cubeRobot((int) round(kWeakIntraCubeSide * cbrt((double) threadCounts[i])));
+        ScalingResult result = runIntra(cube, threadCounts[i]);
+        result.scaling = "weak";
+        weakBase = i == 0 ? result.springStepsPerSecond : weakBase;
+        report(results, result, weakBase, triad[i]);
+    }
+
+    writeResults(results);
+    return 0;
+}
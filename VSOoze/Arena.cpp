@@ -0,0 +1,60 @@
+#include <stdlib.h>
+#include <algorithm>
+
+#include "Arena.h"
+#include "Metrics.h"
+
+Arena::~Arena() {
+    for (auto it = this->blocks.begin(); it != this->blocks.end(); ++it) {
+        addToGauge(arenaBytesGauge, -(long long) (*it).size);
+        free((*it).memory);
+    }
+}
+
+void *Arena::allocate(size_t bytes, size_t alignment) {
+    while (this->current < this->blocks.size()) {
+        Block &block = this->blocks[this->current];
+        const size_t start = (this->offset + alignment - 1) & ~(alignment - 1);
+        if (start + bytes <= block.size) {
+            this->offset = start + bytes;
+            return block.memory + start;
+        }
+        // Doesn't fit - the rest of this block waits for the next reset
+        this->current++;
+        this->offset = 0;
+    }
+    // malloc aligns for any fundamental type so the block's start needs no adjusting
+    Block block = {NULL, std::max(kArenaBlockBytes, bytes)};
+    block.memory = (char *) malloc(block.size);
+    this->blocks.push_back(block);
+    this->current = this->blocks.size() - 1;
+    this->offset = bytes;
+    countMetric(arenaBlocksCounter, 1);
+    addToGauge(arenaBytesGauge, (long long) block.size);
+    return block.memory;
+}
+
+void Arena::reset() {
+    this->current = 0;
+    this->offset = 0;
+}
+
+Arena &threadArena() {
+    thread_local Arena arena;
+    return arena;
+}
+
+ArenaScope::ArenaScope() {
+    threadArena().depth++;
+}
+
+ArenaScope::~ArenaScope() {
+    Arena &arena = threadArena();
+    if (--arena.depth == 0) {
+        arena.reset();
+    }
+}
+
+void countBufferPoolLookup(bool hit) {
+    countMetric(hit ? bufferPoolHitsCounter : bufferPoolMissesCounter, 1);
+}
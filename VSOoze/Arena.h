@@ -0,0 +1,131 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Scratch memory for building and simulating robots without going to the global allocator once warmed up.
+// Each thread bump allocates out of its own arena, which an ArenaScope hands back wholesale when it ends. Buffers
+// that cross threads - the phenotype is built on one, simulated on another and dropped on a third - go through
+// BufferPools instead. Both report to the metrics: arena_blocks_total and buffer_pool_misses_total stop climbing
+// once evaluation is allocation free
+
+const size_t kArenaBlockBytes = 256 * 1024;
+const int kMaxPooledBuffers = 1024; // per element type
+
+class Arena {
+public:
+    ~Arena();
+
+    // Only valid inside an ArenaScope on this thread
+    void *allocate(size_t bytes, size_t alignment);
+
+    // Rewinds to the first block, keeping every block for next time
+    void reset();
+
+    int depth = 0; // nested ArenaScopes
+
+private:
+    struct Block {
+        char *memory;
+        size_t size;
+    };
+
+    std::vector<Block> blocks;
+    size_t current = 0; // block being bumped
+    size_t offset = 0; // into the current block
+};
+
+Arena &threadArena();
+
+// Everything allocated from this thread's arena since the outermost scope began is freed when it ends
+class ArenaScope {
+public:
+    ArenaScope();
+    ~ArenaScope();
+};
+
+// Standard allocator drawing from the calling thread's arena - deallocate does nothing, the scope frees it all.
+// Containers using it must not outlive the scope or leave the thread
+template <typename T>
+struct ArenaAllocator {
+    typedef T value_type;
+
+    ArenaAllocator() {}
+    template <typename U> ArenaAllocator(const ArenaAllocator<U> &) {}
+
+    T *allocate(size_t n) {
+        return (T *) threadArena().allocate(n * sizeof(T), alignof(T));
+    }
+
+    void deallocate(T *, size_t) {}
+
+    template <typename U> bool operator==(const ArenaAllocator<U> &) const { return true; }
+    template <typename U> bool operator!=(const ArenaAllocator<U> &) const { return false; }
+};
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+void countBufferPoolLookup(bool hit);
+
+// Vectors keep their capacity while pooled so a recycled one rarely has to grow
+template <typename T>
+class BufferPool {
+public:
+    BufferPool() {
+        this->buffers.reserve(kMaxPooledBuffers);
+    }
+
+    // Empty, with whatever capacity the last user left it
+    std::vector<T> acquire() {
+        std::vector<T> buffer;
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            if (!this->buffers.empty()) {
+                buffer = std::move(this->buffers.back());
+                this->buffers.pop_back();
+            }
+        }
+        countBufferPoolLookup(buffer.capacity() > 0);
+        return buffer;
+    }
+
+    // Leaves buffer empty
+    void release(std::vector<T> &buffer) {
+        if (buffer.capacity() == 0) {
+            return;
+        }
+        buffer.clear();
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (this->buffers.size() < kMaxPooledBuffers) {
+            this->buffers.push_back(std::move(buffer));
+        }
+        buffer = std::vector<T>(); // frees it if the pool was full
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<std::vector<T>> buffers;
+};
+
+// One pool per element type for the whole process - never freed
+template <typename T>
+BufferPool<T> &bufferPool() {
+    static BufferPool<T> *pool = new BufferPool<T>();
+    return *pool;
+}
+
+template <typename T>
+std::vector<T> acquireBuffer() {
+    return bufferPool<T>().acquire();
+}
+
+template <typename T>
+void releaseBuffer(std::vector<T> &buffer) {
+    bufferPool<T>().release(buffer);
+}
+
+#endif
@@ -0,0 +1,546 @@
+#include <cmath>
+
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <set>
+#include <thread>
+
+#include "Conformance.h"
+#include "EvaluationLog.h"
+#include "SimBackend.h"
+
+// Goldens always come from one thread per robot so the reference never depends on how work was split
+const IntraRobotThreading kSerialThreading = {1 << 30, 1, 0};
+const IntraRobotThreading kTeamThreading = {0, 4, 3}; // every robot split across a team
+
+// Relative fitness errors are taken against at least this, in m/s, so robots that barely move don't dominate
+const double kConformanceFitnessFloor = 0.001;
+
+struct ConformanceFileHeader {
+    unsigned long long magic;
+    unsigned long long recordSize;
+    unsigned long long count;
+    double sampleInterval;
+    double horizon;
+};
+
+// Mass weighted, NaN if the robot has no mass
+void pointsCenterOfMass(std::vector<Point> &points, double *center) {
+    double mass = 0;
+    center[0] = 0;
+    center[1] = 0;
+    center[2] = 0;
+    for (auto it = points.begin(); it != points.end(); ++it) {
+        double pm = (*it).mass;
+        center[0] += (*it).x * pm;
+        center[1] += (*it).y * pm;
+        center[2] += (*it).z * pm;
+        mass += pm;
+    }
+    for (int i = 0; i < 3; i++) {
+        center[i] = mass == 0 ? NAN : center[i] / mass;
+    }
+}
+
+struct CPUConformanceState {
+    SimInputs inputs;
+    CompactSprings springs;
+    SimOptions options;
+};
+
+ConformanceSim loadCPU(OozebotEncoding &encoding, float nudge, SimIntegrator integrator) {
+    std::shared_ptr<CPUConformanceState> state = std::make_shared<CPUConformanceState>();
+    state->inputs = OozebotEncoding::inputsFromEncoding(encoding);
+    state->inputs.points[0].x += nudge;
+    state->springs = compactSprings(state->inputs.springs);
+    state->options = simOptionsForRobot(state->inputs.points, state->inputs.springs, integrator);
+    const float frequency = (float) encoding.globalTimeInterval;
+    ConformanceSim sim;
+    sim.advance = [state, frequency](double n, double t) {
+        return simulateCompactCPP(state->inputs.points, state->springs, state->inputs.springPresets, n, t, frequency, state->options);
+    };
+    sim.centerOfMass = [state](double *center) { pointsCenterOfMass(state->inputs.points, center); };
+    sim.length = state->inputs.length;
+    return sim;
+}
+
+struct LatticeConformanceState {
+    LatticeRobot robot;
+    std::vector<FlexPreset> presets;
+    std::vector<Point> points;
+};
+
+ConformanceSim loadLattice(OozebotEncoding &encoding, float nudge) {
+    std::shared_ptr<LatticeConformanceState> state = std::make_shared<LatticeConformanceState>();
+    state->robot = OozebotEncoding::latticeFromEncoding(encoding);
+    state->robot.x[state->robot.nodeSpans[0].start] += nudge;
+    for (auto it = encoding.boxCommands.begin(); it != encoding.boxCommands.end(); it++) {
+        state->presets.push_back({(*it).a, (*it).b, (*it).c});
+    }
+    const float frequency = (float) encoding.globalTimeInterval;
+    ConformanceSim sim;
+    sim.advance = [state, frequency](double n, double t) {
+        return simulateLattice(state->robot, state->presets, n, t, frequency);
+    };
+    // Nodes aren't in the same order as the cpu engine's points but the center of mass doesn't care
+    sim.centerOfMass = [state](double *center) {
+        latticeToPoints(state->robot, state->points);
+        pointsCenterOfMass(state->points, center);
+    };
+    sim.length = state->robot.length;
+    return sim;
+}
+
+struct CUDAConformanceState {
+    SimInputs inputs;
+    AsyncSimHandle handle;
+    bool started;
+
+    ~CUDAConformanceState() {
+        releaseSimHandle(this->handle);
+    }
+};
+
+ConformanceSim loadCUDA(OozebotEncoding &encoding, float nudge) {
+    std::shared_ptr<CUDAConformanceState> state = std::make_shared<CUDAConformanceState>();
+    state->inputs = OozebotEncoding::inputsFromEncoding(encoding);
+    state->inputs.points[0].x += nudge;
+    state->handle = createSimHandle((int) encoding.id, (int) state->inputs.points.size(), (int) state->inputs.springs.size());
+    state->started = false;
+    const double frequency = encoding.globalTimeInterval;
+    ConformanceSim sim;
+    // The first call uploads the robot and always starts from t = 0, after that the device copy carries on.
+    // Both copy the points back into inputs
+    sim.advance = [state, frequency](double n, double t) {
+        if (!state->started) {
+            state->started = true;
+            simulate(state->handle, state->inputs.points, state->inputs.springs, state->inputs.springPresets, n, frequency);
+            return !isinf(state->handle.duration);
+        }
+        simulateAgain(state->handle, state->inputs.springPresets, t, n, frequency);
+        return true;
+    };
+    sim.centerOfMass = [state](double *center) { pointsCenterOfMass(state->inputs.points, center); };
+    sim.length = state->inputs.length;
+    return sim;
+}
+
+std::vector<ConformanceEngine> conformanceEngines(bool includeCuda) {
+    std::vector<ConformanceEngine> engines;
+    engines.push_back({"cpu", kSerialThreading, kDefaultConformanceTolerances, [](OozebotEncoding &encoding, float nudge) {
+        return loadCPU(encoding, nudge, eulerIntegrator);
+    }});
+    engines.push_back({"cpu team", kTeamThreading, kDefaultConformanceTolerances, [](OozebotEncoding &encoding, float nudge) {
+        return loadCPU(encoding, nudge, eulerIntegrator);
+    }});
+    engines.push_back({"cpu symplectic", kSerialThreading, kSymplecticConformanceTolerances, [](OozebotEncoding &encoding, float nudge) {
+        return loadCPU(encoding, nudge, symplecticIntegrator);
+    }});
+    engines.push_back({"lattice", kSerialThreading, kDefaultConformanceTolerances, &loadLattice});
+    if (includeCuda) {
+        engines.push_back({"cuda", kSerialThreading, kDefaultConformanceTolerances, &loadCUDA});
+    }
+    return engines;
+}
+
+bool finiteCenter(double *center) {
+    return !isnan(center[0]) && !isinf(center[0]) && !isnan(center[1]) && !isinf(center[1]) && !isnan(center[2]) && !isinf(center[2]);
+}
+
+ConformanceResult runConformance(ConformanceEngine &engine, OozebotEncoding &encoding, double duration, float nudge) {
+    ConformanceResult result = {false, 0, 0, {}};
+    ConformanceSim sim = engine.load(encoding, nudge);
+    double center[3];
+    sim.centerOfMass(center);
+    result.centerOfMass.insert(result.centerOfMass.end(), center, center + 3);
+    bool valid = finiteCenter(center);
+    // Whole samples so every engine stops at exactly the same times
+    const int numSamples = (int) round(kConformanceHorizon / kConformanceSampleInterval);
+    double t = 0;
+    for (int i = 1; i <= numSamples && valid; i++) {
+        const double next = i * kConformanceSampleInterval;
+        valid = sim.advance(next, t);
+        sim.centerOfMass(center);
+        result.centerOfMass.insert(result.centerOfMass.end(), center, center + 3);
+        valid = valid && finiteCenter(center);
+        t = next;
+    }
+    valid = valid && sim.advance(1.0, t);
+    if (!valid) {
+        return result;
+    }
+    double start[3];
+    sim.centerOfMass(start);
+    duration = stretchedDuration(duration, encoding.globalTimeInterval);
+    valid = sim.advance(duration - 1.0, 0);
+    sim.centerOfMass(center);
+    if (!valid || !finiteCenter(start) || !finiteCenter(center)) {
+        return result;
+    }
+    const double deltaX = center[0] - start[0];
+    const double deltaZ = center[2] - start[2];
+    result.valid = true;
+    result.fitness = sqrt(deltaX * deltaX + deltaZ * deltaZ) / duration;
+    result.lengthAdj = result.fitness / sim.length;
+    return result;
+}
+
+ConformanceGolden goldenForEncoding(ConformanceEngine &reference, OozebotEncoding encoding, double duration) {
+    ConformanceResult result = runConformance(reference, encoding, duration);
+    ConformanceResult nudged = runConformance(reference, encoding, duration, kConformanceNudge);
+    nudged.centerOfMass.clear();
+    encoding.fitness = result.fitness;
+    encoding.lengthAdj = result.lengthAdj;
+    return { encoding, duration, result, nudged };
+}
+
+std::vector<ConformanceGolden> generateConformanceGoldens(int corpusSize, double duration, ConformanceEngine reference) {
+    configureIntraRobotThreading(kSerialThreading);
+    const int numThreads = std::max(1, (int) std::thread::hardware_concurrency());
+    std::vector<ConformanceGolden> goldens;
+    std::vector<std::future<ConformanceGolden>> threads;
+    while (goldens.size() < corpusSize) {
+        const int batchSize = std::min(numThreads, corpusSize - (int) goldens.size());
+        for (int i = 0; i < batchSize; i++) {
+            OozebotEncoding encoding = OozebotEncoding::randomEncoding();
+            threads.push_back(std::async(std::launch::async, [&reference, encoding, duration]() {
+                return goldenForEncoding(reference, encoding, duration);
+            }));
+        }
+        for (auto it = threads.begin(); it != threads.end(); ++it) {
+            goldens.push_back((*it).get());
+        }
+        threads.clear();
+    }
+    return goldens;
+}
+
+bool writeConformanceGoldens(const std::string &path, std::vector<ConformanceGolden> &goldens) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        printf("Couldn't write goldens to %s\n", path.c_str());
+        return false;
+    }
+    ConformanceFileHeader header = {kConformanceMagic, sizeof(EvaluationRecord), goldens.size(), kConformanceSampleInterval, kConformanceHorizon};
+    file.write((const char *) &header, sizeof(header));
+    for (auto it = goldens.begin(); it != goldens.end(); ++it) {
+        EvaluationRecord record;
+        fillEvaluationRecord(record, (*it).encoding);
+        const int valid = (*it).result.valid ? 1 : 0;
+        const int nudgedValid = (*it).nudged.valid ? 1 : 0;
+        const int numFloats = (int) (*it).result.centerOfMass.size();
+        file.write((const char *) &record, sizeof(record));
+        file.write((const char *) &(*it).duration, sizeof(double));
+        file.write((const char *) &valid, sizeof(int));
+        file.write((const char *) &nudgedValid, sizeof(int));
+        file.write((const char *) &(*it).nudged.fitness, sizeof(double));
+        file.write((const char *) &(*it).nudged.lengthAdj, sizeof(double));
+        file.write((const char *) &numFloats, sizeof(int));
+        file.write((const char *) (*it).result.centerOfMass.data(), numFloats * sizeof(float));
+    }
+    file.close();
+    return true;
+}
+
+bool readConformanceGoldens(const std::string &path, std::vector<ConformanceGolden> &goldens) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+    ConformanceFileHeader header;
+    file.read((char *) &header, sizeof(header));
+    if (!file || header.magic != kConformanceMagic || header.recordSize != sizeof(EvaluationRecord)
+        || header.sampleInterval != kConformanceSampleInterval || header.horizon != kConformanceHorizon) {
+        printf("%s isn't a golden file from this build\n", path.c_str());
+        return false;
+    }
+    goldens.clear();
+    for (unsigned long long i = 0; i < header.count; i++) {
+        EvaluationRecord record;
+        ConformanceGolden golden;
+        int valid = 0;
+        int nudgedValid = 0;
+        int numFloats = 0;
+        file.read((char *) &record, sizeof(record));
+        file.read((char *) &golden.duration, sizeof(double));
+        file.read((char *) &valid, sizeof(int));
+        file.read((char *) &nudgedValid, sizeof(int));
+        file.read((char *) &golden.nudged.fitness, sizeof(double));
+        file.read((char *) &golden.nudged.lengthAdj, sizeof(double));
+        file.read((char *) &numFloats, sizeof(int));
+        if (!file || numFloats < 0) {
+            printf("%s is truncated\n", path.c_str());
+            return false;
+        }
+        golden.encoding = encodingFromRecord(record);
+        golden.result.valid = valid != 0;
+        golden.result.fitness = record.fitness;
+        golden.result.lengthAdj = record.lengthAdj;
+        golden.result.centerOfMass.resize(numFloats);
+        golden.nudged.valid = nudgedValid != 0;
+        file.read((char *) golden.result.centerOfMass.data(), numFloats * sizeof(float));
+        goldens.push_back(golden);
+    }
+    return (bool) file;
+}
+
+const float kSlidingSpeed = 1.0f; // m/s along x
+const double kSlidingSeconds = 1.0; // kinetic friction of 1 stops it in about a tenth of that
+const float kRestingSpeed = 0.01f; // m/s
+
+// One voxel high, width by width voxels, resting on the ground and sliding along x
+void slidingSlab(int width, std::vector<Point> &points, std::vector<Spring> &springs, LatticeRobot &robot) {
+    const LatticeMaterial material = {0.1f, 1.0f, 0.1f, 10000.0f, 0};
+    std::vector<LatticeMaterial> materials = {material};
+    std::vector<LatticeVoxel> voxels;
+    for (int x = 0; x < width; x++) {
+        for (int z = 0; z < width; z++) {
+            voxels.push_back({x, 0, z, 0});
+        }
+    }
+    robot = createLatticeRobot(voxels, materials, 0);
+    latticeToPoints(robot, points);
+    for (auto it = points.begin(); it != points.end(); ++it) {
+        (*it).vx = kSlidingSpeed;
+    }
+    for (int i = 0; i < (int) robot.vx.size(); i++) {
+        robot.vx[i] = robot.mass[i] > 0 ? kSlidingSpeed : 0;
+    }
+    // Nodes are a dense grid so a point's index follows from its lattice position
+    auto index = [&](int x, int y, int z) { return (x * 2 + y) * (width + 1) + z; };
+    std::set<std::pair<int, int>> laid;
+    for (auto it = voxels.begin(); it != voxels.end(); ++it) {
+        int corners[8];
+        int numCorners = 0;
+        for (int dx = 0; dx < 2; dx++) {
+            for (int dy = 0; dy < 2; dy++) {
+                for (int dz = 0; dz < 2; dz++) {
+                    corners[numCorners++] = index((*it).x + dx, dy, (*it).z + dz);
+                }
+            }
+        }
+        for (int i = 0; i < 8; i++) {
+            for (int j = i + 1; j < 8; j++) {
+                const int p1 = std::min(corners[i], corners[j]);
+                const int p2 = std::max(corners[i], corners[j]);
+                if (!laid.insert({p1, p2}).second) {
+                    continue;
+                }
+                const float dx = points[p1].x - points[p2].x;
+                const float dy = points[p1].y - points[p2].y;
+                const float dz = points[p1].z - points[p2].z;
+                springs.push_back({material.k, p1, p2, sqrt(dx * dx + dy * dy + dz * dz), points[p1].numSprings, points[p2].numSprings, 0});
+                points[p1].numSprings++;
+                points[p2].numSprings++;
+            }
+        }
+    }
+}
+
+// False, with a note, if any point ever went faster than it started or hadn't stopped by the end
+bool checkSliding(const char *engine, std::function<bool(double, double)> advance, std::function<void(std::vector<Point> &)> sample) {
+    float fastest = 0;
+    float finalSpeed = 0;
+    std::vector<Point> points;
+    for (double t = 0; t < kSlidingSeconds - 1e-9; t += kConformanceSampleInterval) {
+        if (!advance(t + kConformanceSampleInterval, t)) {
+            printf("%s: sliding slab tore itself apart\n", engine);
+            return false;
+        }
+        sample(points);
+        finalSpeed = 0;
+        for (auto it = points.begin(); it != points.end(); ++it) {
+            const float speed = sqrt((*it).vx * (*it).vx + (*it).vz * (*it).vz);
+            fastest = std::max(fastest, speed);
+            finalSpeed = std::max(finalSpeed, speed);
+        }
+    }
+    const bool passed = fastest <= kSlidingSpeed * 1.01f && finalSpeed <= kRestingSpeed;
+    if (!passed) {
+        printf("%s: sliding slab peaked at %g m/s and ended at %g m/s\n", engine, fastest, finalSpeed);
+    }
+    return passed;
+}
+
+bool checkSlidingFriction() {
+    const SimOptions options = {kDefaultTimestep, eulerIntegrator, constraintContact, kDefaultPhysics};
+    std::vector<FlexPreset> presets = {{1, 0, 0}}; // no actuation
+    bool passed = true;
+    // The small path, and the general one past kSmallRobotPoints (32 x 32 voxels is 2178 points)
+    const int widths[] = {1, 32};
+    for (int w = 0; w < 2; w++) {
+        std::vector<Point> points;
+        std::vector<Spring> springs;
+        LatticeRobot robot;
+        slidingSlab(widths[w], points, springs, robot);
+        std::vector<Point> start = points;
+        passed = checkSliding(w == 0 ? "cpu small" : "cpu", [&](double n, double t) {
+            return simulateAgainCPP(points, springs, presets, n, t, 1.0f, options);
+        }, [&](std::vector<Point> &out) { out = points; }) && passed;
+        passed = checkSliding(w == 0 ? "lattice small" : "lattice", [&](double n, double t) {
+            return simulateLattice(robot, presets, n, t, 1.0f, options);
+        }, [&](std::vector<Point> &out) { latticeToPoints(robot, out); }) && passed;
+
+        if (w == 0) {
+            CompactSprings compact;
+            compactSprings(springs, compact);
+            std::vector<Point> lanePoints[kControlLanes];
+            std::vector<FlexPreset> lanePresets[kControlLanes];
+            float frequencies[kControlLanes];
+            for (int lane = 0; lane < kControlLanes; lane++) {
+                lanePoints[lane] = start;
+                lanePresets[lane].push_back(presets[0]);
+                frequencies[lane] = 1.0f;
+            }
+            passed = checkSliding("control lanes", [&](double n, double t) {
+                double ends[kControlLanes];
+                bool intact[kControlLanes];
+                for (int lane = 0; lane < kControlLanes; lane++) {
+                    ends[lane] = n;
+                }
+                simulateControlLanesCPP(lanePoints, compact, lanePresets, frequencies, ends, t, options, intact);
+                return intact[kControlLanes - 1];
+            }, [&](std::vector<Point> &out) { out = lanePoints[kControlLanes - 1]; }) && passed;
+        }
+    }
+    return passed;
+}
+
+// Smallest value at least share of them are within
+double quantile(std::vector<double> values, double share) {
+    if (values.empty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    const int index = (int) ceil(share * values.size()) - 1;
+    return values[std::max(0, std::min((int) values.size() - 1, index))];
+}
+
+double fitnessLogRatio(double value, double golden) {
+    return log(std::max(value, kConformanceFitnessFloor) / std::max(golden, kConformanceFitnessFloor));
+}
+
+ConformanceReport checkConformance(ConformanceEngine &engine, std::vector<ConformanceGolden> &goldens) {
+    configureIntraRobotThreading(engine.threading);
+    std::vector<ConformanceResult> results;
+    // A team engine gets all of its helpers by running one genome at a time
+    const int numThreads = engine.threading.maxTeamSize > 1 ? 1 : std::max(1, (int) std::thread::hardware_concurrency());
+    std::vector<std::future<ConformanceResult>> threads;
+    while (results.size() < goldens.size()) {
+        const int batchSize = std::min(numThreads, (int) (goldens.size() - results.size()));
+        for (int i = 0; i < batchSize; i++) {
+            ConformanceGolden &golden = goldens[results.size() + i];
+            threads.push_back(std::async(std::launch::async, [&engine, &golden]() {
+                OozebotEncoding encoding = golden.encoding;
+                return runConformance(engine, encoding, golden.duration);
+            }));
+        }
+        for (auto it = threads.begin(); it != threads.end(); ++it) {
+            results.push_back((*it).get());
+        }
+        threads.clear();
+    }
+    configureIntraRobotThreading(kSerialThreading);
+
+    ConformanceTolerances &tolerances = engine.tolerances;
+    ConformanceReport report = {engine.name, (int) goldens.size(), 0, 0, 0, 1, 1, 1, 1, false};
+    std::vector<double> deviations, logRatios;
+    std::vector<double> goldenFitness, fitness, goldenLengthAdj, lengthAdj;
+    std::vector<double> referenceGoldenFitness, referenceFitness, referenceGoldenLengthAdj, referenceLengthAdj;
+    for (int i = 0; i < goldens.size(); i++) {
+        ConformanceResult &golden = goldens[i].result;
+        ConformanceResult &nudged = goldens[i].nudged;
+        ConformanceResult &result = results[i];
+        if (golden.valid && nudged.valid) {
+            referenceGoldenFitness.push_back(golden.fitness);
+            referenceFitness.push_back(nudged.fitness);
+            referenceGoldenLengthAdj.push_back(golden.lengthAdj);
+            referenceLengthAdj.push_back(nudged.lengthAdj);
+        }
+        if (result.valid != golden.valid) {
+            report.validityMismatches++;
+            continue;
+        }
+        if (!golden.valid) {
+            continue;
+        }
+        double deviation = result.centerOfMass.size() == golden.centerOfMass.size() ? 0 : INFINITY;
+        for (size_t j = 0; j + 2 < golden.centerOfMass.size() && j + 2 < result.centerOfMass.size(); j += 3) {
+            const double dx = result.centerOfMass[j] - golden.centerOfMass[j];
+            const double dy = result.centerOfMass[j + 1] - golden.centerOfMass[j + 1];
+            const double dz = result.centerOfMass[j + 2] - golden.centerOfMass[j + 2];
+            deviation = std::max(deviation, sqrt(dx * dx + dy * dy + dz * dz));
+        }
+        deviations.push_back(deviation);
+        logRatios.push_back(fitnessLogRatio(result.fitness, golden.fitness));
+        goldenFitness.push_back(golden.fitness);
+        fitness.push_back(result.fitness);
+        goldenLengthAdj.push_back(golden.lengthAdj);
+        lengthAdj.push_back(result.lengthAdj);
+    }
+    report.centerOfMassDeviation = quantile(deviations, tolerances.trajectoryQuantile);
+    report.fitnessBias = quantile(logRatios, 0.5);
+    report.fitnessRankCorrelation = rankCorrelation(goldenFitness, fitness);
+    report.lengthAdjRankCorrelation = rankCorrelation(goldenLengthAdj, lengthAdj);
+    report.referenceFitnessRankCorrelation = rankCorrelation(referenceGoldenFitness, referenceFitness);
+    report.referenceLengthAdjRankCorrelation = rankCorrelation(referenceGoldenLengthAdj, referenceLengthAdj);
+    report.passed = report.validityMismatches <= tolerances.validity * goldens.size()
+        && report.centerOfMassDeviation <= tolerances.centerOfMass
+        && fabs(report.fitnessBias) <= tolerances.fitnessBias
+        && report.fitnessRankCorrelation >= report.referenceFitnessRankCorrelation - tolerances.rankCorrelationMargin
+        && report.lengthAdjRankCorrelation >= report.referenceLengthAdjRankCorrelation - tolerances.rankCorrelationMargin;
+    return report;
+}
+
+void printConformanceReport(ConformanceReport &report) {
+    printf("%s: %s\n", report.engine.c_str(), report.passed ? "PASS" : "FAIL");
+    printf("  %d validity mismatches over %d genomes\n", report.validityMismatches, report.numGenomes);
+    printf("  center of mass deviation within %gs: %gm\n", kConformanceHorizon, report.centerOfMassDeviation);
+    printf("  fitness bias (median log ratio) %f\n", report.fitnessBias);
+    printf("  rank correlation - fitness %f, length adj %f (nudged reference %f, %f)\n", report.fitnessRankCorrelation,
+        report.lengthAdjRankCorrelation, report.referenceFitnessRankCorrelation, report.referenceLengthAdjRankCorrelation);
+}
+
+std::vector<double> ranks(std::vector<double> &values) {
+    std::vector<int> order(values.size());
+    for (int i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](int a, int b) { return values[a] < values[b]; });
+    std::vector<double> result(values.size());
+    int i = 0;
+    while (i < order.size()) {
+        int j = i;
+        while (j + 1 < order.size() && values[order[j + 1]] == values[order[i]]) {
+            j++;
+        }
+        for (int k = i; k <= j; k++) {
+            result[order[k]] = (i + j) / 2.0; // ties share their average rank
+        }
+        i = j + 1;
+    }
+    return result;
+}
+
+double rankCorrelation(std::vector<double> &first, std::vector<double> &second) {
+    std::vector<double> firstRanks = ranks(first);
+    std::vector<double> secondRanks = ranks(second);
+    double n = (double) first.size();
+    double meanRank = (n - 1) / 2.0;
+    double covariance = 0;
+    double firstVariance = 0;
+    double secondVariance = 0;
+    for (int i = 0; i < first.size(); i++) {
+        covariance += (firstRanks[i] - meanRank) * (secondRanks[i] - meanRank);
+        firstVariance += (firstRanks[i] - meanRank) * (firstRanks[i] - meanRank);
+        secondVariance += (secondRanks[i] - meanRank) * (secondRanks[i] - meanRank);
+    }
+    if (firstVariance == 0 || secondVariance == 0) {
+        return 1;
+    }
+    return covariance / sqrt(firstVariance * secondVariance);
+}
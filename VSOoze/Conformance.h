@@ -0,0 +1,110 @@
+#ifndef CONFORMANCE_H
+#define CONFORMANCE_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "OozebotEncoding.h"
+
+// Golden results for a fixed corpus of genomes, so any other engine (or a faster version of this one) can be checked
+// for silently changing what evolution sees. The genomes themselves are stored since random encodings can't be
+// reproduced from a seed. The committed goldens came from the scalar engine as it was before any of the faster
+// engines existed.
+// Robots are chaotic - moving one point by a micron changes most of their fitnesses completely within a couple of
+// seconds - so trajectories are only compared over the first kConformanceHorizon, and fitness and ranking only as
+// statistics over the whole corpus, measured against what that micron does to the reference itself
+
+const char *const kConformanceGoldenPath = "conformance/goldens.bin"; // relative to VSOoze
+const double kConformanceSampleInterval = 0.01; // seconds of simulated time between center of mass samples
+const double kConformanceHorizon = 0.05; // seconds from the first step that trajectories are compared over
+const float kConformanceNudge = 1e-6f; // meters the reference moves one point by to measure its own chaos
+const unsigned long long kConformanceMagic = 0x4f4f5a45474f4c32; // "OOZEGOL2"
+
+struct ConformanceTolerances {
+    double centerOfMass; // meters - deviation within the horizon
+    double trajectoryQuantile; // share of the corpus that has to stay within centerOfMass
+    double validity; // share of the corpus allowed to disagree on whether the robot blows up
+    double fitnessBias; // largest |median log ratio| of fitness against the goldens
+    double rankCorrelationMargin; // how far either objective's Spearman's rho may fall below the nudged reference's
+};
+
+// For engines that step like the reference - anything past float rounding within the horizon is a physics change
+const ConformanceTolerances kDefaultConformanceTolerances = {0.00001, 0.75, 0.05, 0.1, 0.15};
+
+// A different integrator and timestep drifts by a fraction of a millimeter within the horizon on its own
+const ConformanceTolerances kSymplecticConformanceTolerances = {0.0005, 0.75, 0.05, 0.1, 0.15};
+
+// Every engine runs the same protocol - settle for a second from t = 0, sampling the center of mass up to the
+// horizon, then run from t = 0 again for the duration stretched to whole oscillations (as evaluate does)
+struct ConformanceResult {
+    bool valid;
+    double fitness;
+    double lengthAdj;
+    std::vector<float> centerOfMass; // x, y, z per sample from t = 0 to the horizon
+};
+
+struct ConformanceGolden {
+    OozebotEncoding encoding;
+    double duration;
+    ConformanceResult result;
+    ConformanceResult nudged; // the reference again with kConformanceNudge - no trajectory kept
+};
+
+// One robot loaded into an engine. advance steps it from simulated time t to n and returns false if it blew up
+struct ConformanceSim {
+    std::function<bool(double, double)> advance;
+    std::function<void(double *)> centerOfMass; // x, y, z
+    double length;
+};
+
+struct ConformanceEngine {
+    std::string name;
+    IntraRobotThreading threading; // applied before the engine runs the corpus
+    ConformanceTolerances tolerances;
+    // The float is meters to move the robot's first point along x by before it starts
+    std::function<ConformanceSim(OozebotEncoding &, float)> load;
+};
+
+struct ConformanceReport {
+    std::string engine;
+    int numGenomes;
+    int validityMismatches;
+    double centerOfMassDeviation; // at the tolerance's quantile of the corpus
+    double fitnessBias; // median log ratio against the goldens
+    double fitnessRankCorrelation;
+    double lengthAdjRankCorrelation;
+    double referenceFitnessRankCorrelation; // the nudged reference against the goldens
+    double referenceLengthAdjRankCorrelation;
+    bool passed;
+};
+
+// The scalar engine first - it's the one goldens are regenerated from
+std::vector<ConformanceEngine> conformanceEngines(bool includeCuda);
+
+ConformanceResult runConformance(ConformanceEngine &engine, OozebotEncoding &encoding, double duration, float nudge = 0);
+
+// Random genomes run through reference, with and without the nudge, spread over the available cores
+std::vector<ConformanceGolden> generateConformanceGoldens(int corpusSize, double duration, ConformanceEngine reference);
+
+bool writeConformanceGoldens(const std::string &path, std::vector<ConformanceGolden> &goldens);
+
+// False if the file is missing or from an incompatible build
+bool readConformanceGoldens(const std::string &path, std::vector<ConformanceGolden> &goldens);
+
+// Genomes run in parallel unless the engine splits robots across a team
+ConformanceReport checkConformance(ConformanceEngine &engine, std::vector<ConformanceGolden> &goldens);
+
+void printConformanceReport(ConformanceReport &report);
+
+// A slab sliding along the ground under constraint contact, with kinetic friction ten times static (the encoding draws
+// them independently), has to come to rest without ever speeding up. Runs the small and general cpu paths, the
+// control lanes and the lattice engine, printing any that fail
+bool checkSlidingFriction();
+
+std::vector<double> ranks(std::vector<double> &values);
+
+// Spearman's rho - 1 means the two evaluations order every robot identically
+double rankCorrelation(std::vector<double> &first, std::vector<double> &second);
+
+#endif
@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+#if defined (_MSC_VER)
+    #define NOMINMAX
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+#include "EvaluationLog.h"
+
+double evaluationLogClock() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+EvaluationLogHeader *logHeader(EvaluationLog &log) {
+    return (EvaluationLogHeader *) log.base;
+}
+
+size_t logFileSize(long capacity) {
+    return kEvaluationLogHeaderSize + (size_t) capacity * sizeof(EvaluationRecord);
+}
+
+// Platform specific pieces - everything else only touches log.base
+
+#if defined (_MSC_VER)
+
+bool openLogFile(EvaluationLog &log) {
+    log.file = CreateFileA(log.path.c_str(), log.writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, log.writable ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    log.mapping = NULL;
+    return log.file != INVALID_HANDLE_VALUE;
+}
+
+size_t currentFileSize(EvaluationLog &log) {
+    LARGE_INTEGER size;
+    return GetFileSizeEx(log.file, &size) ? (size_t) size.QuadPart : 0;
+}
+
+// size 0 maps the whole file as it is now. Mapping a writable file bigger than it is grows it
+bool mapLogFile(EvaluationLog &log, size_t size) {
+    const unsigned long long mappingSize = size;
+    log.mapping = CreateFileMappingA(log.file, NULL, log.writable ? PAGE_READWRITE : PAGE_READONLY,
+        (DWORD) (mappingSize >> 32), (DWORD) (mappingSize & 0xffffffff), NULL);
+    if (log.mapping == NULL) {
+        return false;
+    }
+    log.base = (char *) MapViewOfFile(log.mapping, log.writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size);
+    log.mappedSize = size != 0 ? size : currentFileSize(log);
+    return log.base != NULL;
+}
+
+void unmapLogFile(EvaluationLog &log) {
+    if (log.base != NULL) {
+        UnmapViewOfFile(log.base);
+        log.base = NULL;
+    }
+    if (log.mapping != NULL) {
+        CloseHandle(log.mapping);
+        log.mapping = NULL;
+    }
+}
+
+void closeLogFile(EvaluationLog &log) {
+    if (log.file != INVALID_HANDLE_VALUE) {
+        CloseHandle(log.file);
+        log.file = INVALID_HANDLE_VALUE;
+    }
+}
+
+#else
+
+bool openLogFile(EvaluationLog &log) {
+    log.file = log.writable ? open(log.path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644) : open(log.path.c_str(), O_RDONLY);
+    return log.file >= 0;
+}
+
+size_t currentFileSize(EvaluationLog &log) {
+    struct stat info;
+    return fstat(log.file, &info) == 0 ? (size_t) info.st_size : 0;
+}
+
+// size 0 maps the whole file as it is now
+bool mapLogFile(EvaluationLog &log, size_t size) {
+    if (log.writable && ftruncate(log.file, size) != 0) {
+        return false;
+    }
+    log.mappedSize = size != 0 ? size : currentFileSize(log);
+    void *base = mmap(NULL, log.mappedSize, log.writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, log.file, 0);
+    log.base = base == MAP_FAILED ? NULL : (char *) base;
+    return log.base != NULL;
+}
+
+void unmapLogFile(EvaluationLog &log) {
+    if (log.base != NULL) {
+        munmap(log.base, log.mappedSize);
+        log.base = NULL;
+    }
+}
+
+void closeLogFile(EvaluationLog &log) {
+    if (log.file >= 0) {
+        close(log.file);
+        log.file = -1;
+    }
+}
+
+#endif
+
+EvaluationLog emptyLog(const std::string &path, bool writable) {
+    EvaluationLog log;
+    log.writable = writable;
+    log.path = path;
+    log.base = NULL;
+    log.mappedSize = 0;
+    log.createdAt = evaluationLogClock();
+    log.indexedCount = 0;
+    return log;
+}
+
+EvaluationLog createEvaluationLog(const std::string &path) {
+    EvaluationLog log = emptyLog(path, true);
+    if (!openLogFile(log) || !mapLogFile(log, logFileSize(kInitialEvaluationLogCapacity))) {
+        printf("Couldn't create evaluation log %s\n", path.c_str());
+        closeEvaluationLog(log);
+        return log;
+    }
+    EvaluationLogHeader *header = logHeader(log);
+    header->magic = kEvaluationLogMagic;
+    header->recordSize = sizeof(EvaluationRecord);
+    header->capacity.store(kInitialEvaluationLogCapacity, std::memory_order_relaxed);
+    header->count.store(0, std::memory_order_release);
+    return log;
+}
+
+EvaluationLog openEvaluationLog(const std::string &path) {
+    EvaluationLog log = emptyLog(path, false);
+    if (!openLogFile(log) || currentFileSize(log) < kEvaluationLogHeaderSize || !mapLogFile(log, 0)) {
+        printf("Couldn't open evaluation log %s\n", path.c_str());
+        closeEvaluationLog(log);
+        return log;
+    }
+    EvaluationLogHeader *header = logHeader(log);
+    if (header->magic != kEvaluationLogMagic || header->recordSize != sizeof(EvaluationRecord)) {
+        printf("%s isn't an evaluation log from this build\n", path.c_str());
+        closeEvaluationLog(log);
+    }
+    return log;
+}
+
+void closeEvaluationLog(EvaluationLog &log) {
+    unmapLogFile(log);
+    closeLogFile(log);
+}
+
+// Writer only - doubles the file. Readers pick the new size up on their next evaluationCount
+bool growEvaluationLog(EvaluationLog &log) {
+    const long capacity = (long) logHeader(log)->capacity.load(std::memory_order_relaxed) * 2;
+    unmapLogFile(log);
+    if (!mapLogFile(log, logFileSize(capacity))) {
+        printf("Couldn't grow evaluation log %s to %ld records\n", log.path.c_str(), capacity);
+        return false;
+    }
+    logHeader(log)->capacity.store(capacity, std::memory_order_release);
+    return true;
+}
+
+void fillEvaluationRecord(EvaluationRecord &record, const OozebotEncoding &encoding) {
+    memset(&record, 0, sizeof(EvaluationRecord));
+    record.id = encoding.id;
+    record.parentIds[0] = encoding.parentIds[0];
+    record.parentIds[1] = encoding.parentIds[1];
+    record.fitness = encoding.fitness;
+    record.lengthAdj = encoding.lengthAdj;
+    record.globalTimeInterval = encoding.globalTimeInterval;
+    record.evaluationSeconds = encoding.evaluationSeconds;
+    for (int i = 0; i < kNumBoxes && i < encoding.boxCommands.size(); i++) {
+        record.boxCommands[i] = encoding.boxCommands[i];
+    }
+    for (int i = 0; i < kMaxLayAndMoveSequences && i < encoding.layAndMoveCommands.size(); i++) {
+        const std::vector<OozebotExpression> &sequence = encoding.layAndMoveCommands[i];
+        record.numLayAndMoveCommands[i] = (int) std::min(sequence.size(), (size_t) kMaxLayAndMoveLength);
+        for (int j = 0; j < record.numLayAndMoveCommands[i]; j++) {
+            record.layAndMoveCommands[i][j] = sequence[j];
+        }
+    }
+    record.bodyCommand = encoding.bodyCommand;
+    record.numGrowthCommands = (int) std::min(encoding.growthCommands.size(), (size_t) kMaxGrowthCommands);
+    for (int i = 0; i < record.numGrowthCommands; i++) {
+        record.growthCommands[i] = encoding.growthCommands[i];
+    }
+}
+
+bool appendEvaluation(EvaluationLog &log, const OozebotEncoding &encoding, EvaluationStatus status) {
+    if (log.base == NULL || !log.writable) {
+        return false;
+    }
+    EvaluationLogHeader *header = logHeader(log);
+    const unsigned long long index = header->count.load(std::memory_order_relaxed);
+    if (index >= header->capacity.load(std::memory_order_relaxed)) {
+        if (!growEvaluationLog(log)) {
+            return false;
+        }
+        header = logHeader(log);
+    }
+
+    EvaluationRecord &record = *(EvaluationRecord *) (log.base + kEvaluationLogHeaderSize + index * sizeof(EvaluationRecord));
+    fillEvaluationRecord(record, encoding);
+    record.loggedAt = evaluationLogClock() - log.createdAt;
+    record.status = status;
+
+    header->count.store(index + 1, std::memory_order_release); // publishes the record
+    return true;
+}
+
+long evaluationCount(EvaluationLog &log) {
+    if (log.base == NULL) {
+        return 0;
+    }
+    if (!log.writable && logHeader(log)->capacity.load(std::memory_order_acquire) * sizeof(EvaluationRecord) + kEvaluationLogHeaderSize > log.mappedSize) {
+        unmapLogFile(log);
+        if (!mapLogFile(log, 0)) {
+            return 0;
+        }
+    }
+    return (long) logHeader(log)->count.load(std::memory_order_acquire);
+}
+
+const EvaluationRecord &evaluationRecord(EvaluationLog &log, long index) {
+    return *(const EvaluationRecord *) (log.base + kEvaluationLogHeaderSize + (size_t) index * sizeof(EvaluationRecord));
+}
+
+void catchUpIndices(EvaluationLog &log) {
+    const long count = evaluationCount(log);
+    for (; log.indexedCount < count; log.indexedCount++) {
+        const EvaluationRecord &record = evaluationRecord(log, log.indexedCount);
+        log.idIndex[record.id] = log.indexedCount;
+        log.objectiveIndex[0].insert({record.fitness, log.indexedCount});
+        log.objectiveIndex[1].insert({record.lengthAdj, log.indexedCount});
+    }
+}
+
+const EvaluationRecord *findEvaluation(EvaluationLog &log, unsigned long long id) {
+    catchUpIndices(log);
+    auto it = log.idIndex.find(id);
+    if (it == log.idIndex.end()) {
+        return NULL;
+    }
+    return &evaluationRecord(log, (*it).second);
+}
+
+std::vector<long> topEvaluations(EvaluationLog &log, int objective, int n) {
+    catchUpIndices(log);
+    std::vector<long> indices;
+    for (auto it = log.objectiveIndex[objective].begin(); it != log.objectiveIndex[objective].end() && indices.size() < n; ++it) {
+        indices.push_back((*it).second);
+    }
+    return indices;
+}
+
+OozebotEncoding encodingFromRecord(const EvaluationRecord &record) {
+    OozebotEncoding encoding;
+    encoding.id = (unsigned long int) record.id;
+    encoding.parentIds[0] = (unsigned long int) record.parentIds[0];
+    encoding.parentIds[1] = (unsigned long int) record.parentIds[1];
+    encoding.fitness = record.fitness;
+    encoding.lengthAdj = record.lengthAdj;
+    encoding.globalTimeInterval = record.globalTimeInterval;
+    encoding.evaluationSeconds = record.evaluationSeconds;
+    encoding.boxCommands.assign(record.boxCommands, record.boxCommands + kNumBoxes);
+    for (int i = 0; i < kMaxLayAndMoveSequences; i++) {
+        encoding.layAndMoveCommands.push_back(std::vector<OozebotExpression>(record.layAndMoveCommands[i], record.layAndMoveCommands[i] + record.numLayAndMoveCommands[i]));
+    }
+    encoding.bodyCommand = record.bodyCommand;
+    encoding.growthCommands.assign(record.growthCommands, record.growthCommands + record.numGrowthCommands);
+    return encoding;
+}
@@ -0,0 +1,99 @@
+#ifndef EVALUATION_LOG_H
+#define EVALUATION_LOG_H
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <string>
+#include <unordered_map>
+
+#include "OozebotEncoding.h"
+#include "ObjectiveSet.h"
+
+enum EvaluationStatus {
+    dominatedOnArrival, // something already on the front covered it
+    madeFront, // joined the front when it was logged - it may have been knocked off since
+};
+
+// Fixed layout so analysis tools can read the file straight out of the mapping - sizes are explicit because long
+// differs between MSVC and everyone else
+struct EvaluationRecord {
+    unsigned long long id;
+    unsigned long long parentIds[2];
+    double fitness;
+    double lengthAdj;
+    double globalTimeInterval;
+    double evaluationSeconds;
+    double loggedAt; // seconds since the log was created
+    int status; // EvaluationStatus
+    int numLayAndMoveCommands[kMaxLayAndMoveSequences];
+    int numGrowthCommands;
+    OozebotExpression boxCommands[kNumBoxes];
+    OozebotExpression layAndMoveCommands[kMaxLayAndMoveSequences][kMaxLayAndMoveLength];
+    OozebotExpression bodyCommand;
+    OozebotExpression growthCommands[kMaxGrowthCommands];
+};
+
+const unsigned long long kEvaluationLogMagic = 0x4f4f5a454c4f4731; // "OOZELOG1"
+
+// First page of the file. count is only bumped once the record before it is fully written so readers never see a
+// partial one
+struct EvaluationLogHeader {
+    unsigned long long magic;
+    unsigned long long recordSize;
+    std::atomic<unsigned long long> capacity; // records the file currently has room for
+    std::atomic<unsigned long long> count;
+};
+
+const int kEvaluationLogHeaderSize = 4096;
+const long kInitialEvaluationLogCapacity = 16384; // ~60MB - doubles when full
+
+// Append-only memory mapped log of every evaluation. One process writes, any number can map it read-only while the
+// run is live. The id and objective indices only exist in the process that built them and catch up lazily
+struct EvaluationLog {
+    bool writable;
+    std::string path;
+    char *base; // NULL if the log couldn't be opened
+    size_t mappedSize;
+#if defined (_MSC_VER)
+    void *file;
+    void *mapping;
+#else
+    int file;
+#endif
+    double createdAt;
+    long indexedCount; // records already in the indices below
+    std::unordered_map<unsigned long long, long> idIndex;
+    std::multimap<double, long, std::greater<double>> objectiveIndex[kNumObjectives]; // best first
+};
+
+// Creates or truncates the file
+EvaluationLog createEvaluationLog(const std::string &path);
+
+// Maps an existing log read-only - fine to do while another process appends to it
+EvaluationLog openEvaluationLog(const std::string &path);
+
+void closeEvaluationLog(EvaluationLog &log);
+
+// Only blocks when the file has to grow, which is rare as it doubles
+bool appendEvaluation(EvaluationLog &log, const OozebotEncoding &encoding, EvaluationStatus status);
+
+// Genome and results of the encoding - loggedAt and status are left zeroed
+void fillEvaluationRecord(EvaluationRecord &record, const OozebotEncoding &encoding);
+
+// Number of complete records. For readers this also remaps if the writer has grown the file
+long evaluationCount(EvaluationLog &log);
+
+// index must be below evaluationCount - the record points straight into the mapping
+const EvaluationRecord &evaluationRecord(EvaluationLog &log, long index);
+
+// NULL if the id hasn't been logged
+const EvaluationRecord *findEvaluation(EvaluationLog &log, unsigned long long id);
+
+// Up to n record indices with the highest value of the objective (indexed as in Objectives), best first
+std::vector<long> topEvaluations(EvaluationLog &log, int objective, int n);
+
+// The genome back out of a record - fitness and lengthAdj are filled in but there's no recording
+OozebotEncoding encodingFromRecord(const EvaluationRecord &record);
+
+#endif
@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#if defined (_MSC_VER)
+    #define NOMINMAX
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+    #pragma comment(lib, "Ws2_32.lib")
+    typedef SOCKET MetricsSocket;
+    #define closeMetricsSocket closesocket
+#else
+    #include <arpa/inet.h>
+    #include <netinet/in.h>
+    #include <sys/socket.h>
+    #include <unistd.h>
+    typedef int MetricsSocket;
+    #define INVALID_SOCKET -1
+    #define closeMetricsSocket close
+#endif
+
+#include "Metrics.h"
+
+// A scraper that stops talking is dropped after this rather than holding up the next one
+const int kMetricsSocketTimeoutSeconds = 5;
+
+// Histogram bucket i holds latencies up to kFirstLatencyBucket * 2^i - 10us up to ~80s
+const int kNumLatencyBuckets = 24;
+const double kFirstLatencyBucket = 0.00001;
+
+const char *kCounterNames[numMetricCounters] = {
+    "evaluations_total", "spring_steps_total", "arena_blocks_total", "buffer_pool_hits_total", "buffer_pool_misses_total",
+    "front_replays_total", "sim_steals_total"};
+const char *kGaugeNames[numMetricGauges] = {
+    "front_size", "novelty_results", "evaluations_in_flight", "active_workers", "worker_slots", "arena_bytes", "queue_depth"};
+const char *kPhaseNames[numMetricPhases] = {"generate", "simulate", "collect", "sort", "log", "queue"};
+
+std::atomic<long long> metricCounters[numMetricCounters];
+std::atomic<long long> metricGauges[numMetricGauges];
+std::atomic<long long> latencyBuckets[numMetricPhases][kNumLatencyBuckets + 1]; // last one is +Inf
+std::atomic<long long> latencyMicroseconds[numMetricPhases];
+
+double metricsClock() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void countMetric(MetricCounter counter, long long amount) {
+    metricCounters[counter].fetch_add(amount, std::memory_order_relaxed);
+}
+
+void setGauge(MetricGauge gauge, long long value) {
+    metricGauges[gauge].store(value, std::memory_order_relaxed);
+}
+
+void addToGauge(MetricGauge gauge, long long delta) {
+    metricGauges[gauge].fetch_add(delta, std::memory_order_relaxed);
+}
+
+void recordLatency(MetricPhase phase, double seconds) {
+    int bucket = 0;
+    double bound = kFirstLatencyBucket;
+    while (bucket < kNumLatencyBuckets && seconds > bound) {
+        bucket++;
+        bound *= 2;
+    }
+    latencyBuckets[phase][bucket].fetch_add(1, std::memory_order_relaxed);
+    latencyMicroseconds[phase].fetch_add((long long) (seconds * 1000000), std::memory_order_relaxed);
+}
+
+// Rates are over the time since the previous scrape - only the server thread touches these
+double lastScrapeTime = 0;
+long long lastEvaluations = 0;
+long long lastSpringSteps = 0;
+long long lastSimulateMicroseconds = 0;
+
+void appendMetric(std::string &body, const std::string &name, const char *type, double value) {
+    char line[256];
+    snprintf(line, sizeof(line), "# TYPE oozebot_%s %s\noozebot_%s %.6g\n", name.c_str(), type, name.c_str(), value);
+    body += line;
+}
+
+std::string metricsBody() {
+    std::string body;
+    char line[256];
+    for (int i = 0; i < numMetricCounters; i++) {
+        appendMetric(body, kCounterNames[i], "counter", (double) metricCounters[i].load(std::memory_order_relaxed));
+    }
+    for (int i = 0; i < numMetricGauges; i++) {
+        appendMetric(body, kGaugeNames[i], "gauge", (double) metricGauges[i].load(std::memory_order_relaxed));
+    }
+    const double now = metricsClock();
+    const double elapsed = now - lastScrapeTime;
+    const long long evaluations = metricCounters[evaluationsCounter].load(std::memory_order_relaxed);
+    const long long springSteps = metricCounters[springStepsCounter].load(std::memory_order_relaxed);
+    const long long simulateMicroseconds = latencyMicroseconds[simulatePhase].load(std::memory_order_relaxed);
+    const long long slots = metricGauges[workerSlotsGauge].load(std::memory_order_relaxed);
+    appendMetric(body, "evaluations_per_second", "gauge", (evaluations - lastEvaluations) / elapsed);
+    appendMetric(body, "spring_steps_per_second", "gauge", (springSteps - lastSpringSteps) / elapsed);
+    // Share of the worker slots' time spent simulating
+    appendMetric(body, "worker_utilization", "gauge", slots > 0 ? (simulateMicroseconds - lastSimulateMicroseconds) / 1000000.0 / (elapsed * slots) : 0);
+    lastScrapeTime = now;
+    lastEvaluations = evaluations;
+    lastSpringSteps = springSteps;
+    lastSimulateMicroseconds = simulateMicroseconds;
+
+    body += "# TYPE oozebot_phase_seconds histogram\n";
+    for (int phase = 0; phase < numMetricPhases; phase++) {
+        long long cumulative = 0;
+        double bound = kFirstLatencyBucket;
+        for (int bucket = 0; bucket <= kNumLatencyBuckets; bucket++) {
+            cumulative += latencyBuckets[phase][bucket].load(std::memory_order_relaxed);
+            if (bucket < kNumLatencyBuckets) {
+                snprintf(line, sizeof(line), "oozebot_phase_seconds_bucket{phase=\"%s\",le=\"%g\"} %lld\n", kPhaseNames[phase], bound, cumulative);
+                bound *= 2;
+            } else {
+                snprintf(line, sizeof(line), "oozebot_phase_seconds_bucket{phase=\"%s\",le=\"+Inf\"} %lld\n", kPhaseNames[phase], cumulative);
+            }
+            body += line;
+        }
+        snprintf(line, sizeof(line), "oozebot_phase_seconds_sum{phase=\"%s\"} %.6f\noozebot_phase_seconds_count{phase=\"%s\"} %lld\n",
+            kPhaseNames[phase], latencyMicroseconds[phase].load(std::memory_order_relaxed) / 1000000.0, kPhaseNames[phase], cumulative);
+        body += line;
+    }
+    return body;
+}
+
+void setMetricsSocketTimeouts(MetricsSocket client) {
+#if defined (_MSC_VER)
+    DWORD timeout = kMetricsSocketTimeoutSeconds * 1000;
+#else
+    timeval timeout = {};
+    timeout.tv_sec = kMetricsSocketTimeoutSeconds;
+#endif
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, (const char *) &timeout, sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, (const char *) &timeout, sizeof(timeout));
+}
+
+void serveMetrics(MetricsSocket listener) {
+    while (true) {
+        MetricsSocket client = accept(listener, NULL, NULL);
+        if (client == INVALID_SOCKET) {
+            continue;
+        }
+        setMetricsSocketTimeouts(client); // one client at a time, so a silent one can't be waited on forever
+        char request[4096];
+        recv(client, request, sizeof(request), 0); // whatever was asked for gets the metrics
+        std::string body = metricsBody();
+        std::string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+        size_t sent = 0;
+        while (sent < response.size()) {
+            int n = send(client, response.c_str() + sent, (int) (response.size() - sent), 0);
+            if (n <= 0) {
+                break;
+            }
+            sent += n;
+        }
+        closeMetricsSocket(client);
+    }
+}
+
+bool startMetricsServer(int port) {
+#if defined (_MSC_VER)
+    WSADATA data;
+    if (WSAStartup(MAKEWORD(2, 2), &data) != 0) {
+        return false;
+    }
+#endif
+    MetricsSocket listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener == INVALID_SOCKET) {
+        return false;
+    }
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char *) &reuse, sizeof(reuse));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons((unsigned short) port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // local only
+    if (bind(listener, (sockaddr *) &address, sizeof(address)) != 0 || listen(listener, 4) != 0) {
+        printf("Couldn't serve metrics on port %d\n", port);
+        closeMetricsSocket(listener);
+        return false;
+    }
+    lastScrapeTime = metricsClock();
+    std::thread(serveMetrics, listener).detach();
+    printf("Serving metrics on http://127.0.0.1:%d/metrics\n", port);
+    return true;
+}
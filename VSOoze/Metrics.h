@@ -0,0 +1,50 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+// Process wide counters, gauges and latency histograms - cheap enough to update from every worker. Served as
+// Prometheus text from a tiny HTTP server so long runs can be watched with curl
+
+enum MetricCounter {
+    evaluationsCounter,
+    springStepsCounter, // springs times timesteps simulated
+    arenaBlocksCounter, // blocks arenas had to get from the global allocator
+    bufferPoolHitsCounter, // buffers recycled rather than allocated
+    bufferPoolMissesCounter,
+    frontReplaysCounter, // front entries exported by simulating them again rather than from their recording
+    simStealsCounter, // robots run on a different node to the queue they were submitted to
+    numMetricCounters,
+};
+
+enum MetricGauge {
+    frontSizeGauge,
+    noveltyResultsGauge, // results the novelty buckets are built from
+    inFlightGauge, // evaluations dispatched and not collected yet
+    activeWorkersGauge, // evaluations actually running
+    workerSlotsGauge, // evaluations allowed in flight at once
+    arenaBytesGauge, // held by every thread's arena
+    simQueuedGauge, // submitted to the sim backend and waiting for a worker - SimBackend::queued
+    numMetricGauges,
+};
+
+enum MetricPhase {
+    generatePhase, // mate/mutate/random genome
+    simulatePhase, // an evaluation's time on a sim worker
+    collectPhase, // ParetoFront::evaluateEncoding
+    sortPhase, // ParetoSelector::sort
+    logPhase, // writing a front entry out
+    queuePhase, // waiting in the sim backend for a worker
+    numMetricPhases,
+};
+
+void countMetric(MetricCounter counter, long long amount);
+void setGauge(MetricGauge gauge, long long value);
+void addToGauge(MetricGauge gauge, long long delta);
+void recordLatency(MetricPhase phase, double seconds);
+
+// Seconds on a monotonic clock - for timing phases
+double metricsClock();
+
+// Serves GET /metrics (any path really) on 127.0.0.1:port from a detached thread. False if the port couldn't be bound
+bool startMetricsServer(int port);
+
+#endif
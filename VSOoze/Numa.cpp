@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#if defined (_MSC_VER)
+    #define NOMINMAX
+    #include <windows.h>
+#elif defined(__linux__)
+    #include <dirent.h>
+    #include <pthread.h>
+    #include <sched.h>
+#endif
+
+#include "Numa.h"
+
+// "0-3,8-11" style lists as sysfs writes them
+std::vector<int> parseCpuList(const std::string &list) {
+    std::vector<int> cpus;
+    std::stringstream stream(list);
+    std::string range;
+    while (std::getline(stream, range, ',')) {
+        if (range.empty() || range[0] < '0' || range[0] > '9') {
+            continue;
+        }
+        const size_t dash = range.find('-');
+        const int first = atoi(range.substr(0, dash).c_str());
+        const int last = dash == std::string::npos ? first : atoi(range.substr(dash + 1).c_str());
+        for (int cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+std::vector<NumaNode> numaTopology() {
+    std::vector<NumaNode> nodes;
+#if defined (_MSC_VER)
+    ULONG highestNode = 0;
+    if (GetNumaHighestNodeNumber(&highestNode)) {
+        for (UCHAR node = 0; node <= highestNode; node++) {
+            ULONGLONG mask = 0;
+            if (!GetNumaNodeProcessorMask(node, &mask) || mask == 0) {
+                continue;
+            }
+            NumaNode numaNode = {(int) node, {}};
+            for (int cpu = 0; cpu < 64; cpu++) {
+                if (mask & (1ULL << cpu)) {
+                    numaNode.cpus.push_back(cpu);
+                }
+            }
+            nodes.push_back(numaNode);
+        }
+    }
+#elif defined(__linux__)
+    DIR *directory = opendir("/sys/devices/system/node");
+    if (directory != NULL) {
+        while (dirent *entry = readdir(directory)) {
+            int id;
+            char trailing;
+            if (sscanf(entry->d_name, "node%d%c", &id, &trailing) != 1) {
+                continue;
+            }
+            std::ifstream file("/sys/devices/system/node/" + std::string(entry->d_name) + "/cpulist");
+            std::string list;
+            std::getline(file, list);
+            NumaNode node = {id, parseCpuList(list)};
+            if (!node.cpus.empty()) { // memory-only nodes have no cpus
+                nodes.push_back(node);
+            }
+        }
+        closedir(directory);
+    }
+    std::sort(nodes.begin(), nodes.end(), [](const NumaNode &a, const NumaNode &b) { return a.id < b.id; });
+#endif
+    if (nodes.empty()) {
+        NumaNode node = {0, {}};
+        for (int cpu = 0; cpu < (int) std::max(1u, std::thread::hardware_concurrency()); cpu++) {
+            node.cpus.push_back(cpu);
+        }
+        nodes.push_back(node);
+    }
+    return nodes;
+}
+
+bool pinThreadToCpus(const std::vector<int> &cpus) {
+#if defined (_MSC_VER)
+    DWORD_PTR mask = 0;
+    for (auto it = cpus.begin(); it != cpus.end(); ++it) {
+        if (*it < (int) (8 * sizeof(DWORD_PTR))) {
+            mask |= (DWORD_PTR) 1 << *it;
+        }
+    }
+    return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto it = cpus.begin(); it != cpus.end(); ++it) {
+        if (*it < CPU_SETSIZE) {
+            CPU_SET(*it, &set);
+        }
+    }
+    return CPU_COUNT(&set) > 0 && pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
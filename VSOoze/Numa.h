@@ -0,0 +1,18 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <vector>
+
+struct NumaNode {
+    int id;
+    std::vector<int> cpus;
+};
+
+// Nodes from /sys/devices/system/node on Linux and the NUMA API on Windows (first processor group only). Falls
+// back to one node holding every cpu when the machine doesn't say
+std::vector<NumaNode> numaTopology();
+
+// Pins the calling thread to the cpus - false if the OS wouldn't
+bool pinThreadToCpus(const std::vector<int> &cpus);
+
+#endif
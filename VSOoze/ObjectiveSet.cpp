@@ -0,0 +1,33 @@
+#include "ObjectiveSet.h"
+
+int ObjectiveSet::size() const {
+    return (int) this->values[0].size();
+}
+
+void ObjectiveSet::push_back(const Objectives &objectives) {
+    for (int m = 0; m < kNumObjectives; m++) {
+        this->values[m].push_back(objectives.values[m]);
+    }
+}
+
+void ObjectiveSet::clear() {
+    for (int m = 0; m < kNumObjectives; m++) {
+        this->values[m].clear();
+    }
+}
+
+// Accumulates one objective at a time into byte masks - no branches so it vectorizes across members
+void compareObjective(double candidate, const double * __restrict member, unsigned char * __restrict candidateCovers, unsigned char * __restrict memberCovers, int count) {
+    for (int i = 0; i < count; i++) {
+        candidateCovers[i] &= candidate >= member[i];
+        memberCovers[i] &= member[i] >= candidate;
+    }
+}
+
+void ObjectiveSet::compare(const Objectives &candidate, int count, std::vector<unsigned char> &candidateCovers, std::vector<unsigned char> &memberCovers) const {
+    candidateCovers.assign(count, 1);
+    memberCovers.assign(count, 1);
+    for (int m = 0; m < kNumObjectives; m++) {
+        compareObjective(candidate.values[m], this->values[m].data(), candidateCovers.data(), memberCovers.data(), count);
+    }
+}
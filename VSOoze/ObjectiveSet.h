@@ -0,0 +1,36 @@
+#ifndef OBJECTIVE_SET_H
+#define OBJECTIVE_SET_H
+
+#include <vector>
+
+#include "OozebotEncoding.h"
+
+// Bigger is better for every objective
+const int kNumObjectives = 2;
+
+struct Objectives {
+    double values[kNumObjectives];
+};
+
+inline Objectives objectivesForEncoding(const OozebotEncoding &encoding) {
+    return {{encoding.fitness, encoding.lengthAdj}};
+}
+
+// Objectives of a whole population, stored objective by objective so one candidate is checked against every member
+// a vector at a time. Members keep the order they were added in
+class ObjectiveSet {
+public:
+    int size() const;
+    void push_back(const Objectives &objectives);
+    void clear();
+
+    // Compares the candidate against the first count members. candidateCovers[i] is set if the candidate is at least
+    // as good as member i in every objective (the candidate dominates it), memberCovers[i] if member i is at least as
+    // good as the candidate in every objective
+    void compare(const Objectives &candidate, int count, std::vector<unsigned char> &candidateCovers, std::vector<unsigned char> &memberCovers) const;
+
+private:
+    std::vector<double> values[kNumObjectives];
+};
+
+#endif
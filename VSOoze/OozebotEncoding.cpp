@@ -9,15 +9,15 @@
 #include <random>
 #include <time.h>
 #include <thread>
+#include <chrono>
 
+#include "Arena.h"
 #include "cppSim.h"
+#include "latticeSim.h"
 #include "OozebotEncoding.h"
-
-const int kNumBoxes = 4;
-const int kMaxLayAndMoveSequences = 4;
-const int kMaxLayAndMoveLength = 8;
-const int kMaxGrowthCommands = 6;
-const int kMaxRadius = 3;
+#include "SimBackend.h"
+#include "Metrics.h"
+#include "Trace.h"
 
 std::atomic<unsigned long int> GlobalId(1);
 
@@ -45,6 +45,13 @@ struct Coordinate
         }
 };
 
+// Only live while a robot is being laid out so the nodes come from the thread's arena
+typedef std::map<Coordinate, std::pair<int, int>, std::less<Coordinate>,
+    ArenaAllocator<std::pair<const Coordinate, std::pair<int, int>>>> SlotMap;
+typedef std::map<Coordinate, int, std::less<Coordinate>, ArenaAllocator<std::pair<const Coordinate, int>>> PointIndexMap;
+typedef std::map<std::pair<int, int>, bool, std::less<std::pair<int, int>>,
+    ArenaAllocator<std::pair<const std::pair<int, int>, bool>>> SpringSet;
+
 #if defined (_MSC_VER)  // Visual studio
     #define thread_local __declspec( thread )
 #elif defined (__GCC__) // GCC
@@ -164,6 +171,8 @@ OozebotEncoding OozebotEncoding::randomEncoding() {
     encoding.globalTimeInterval = 2.0 + r * 8.0;
     encoding.lengthAdj = 0;
     encoding.id = GlobalId.fetch_add(1, std::memory_order_relaxed);
+    encoding.parentIds[0] = 0;
+    encoding.parentIds[1] = 0;
     encoding.boxCommands = boxCommands;
     encoding.layAndMoveCommands = layAndMoveSequences;
     encoding.bodyCommand = bodyCommand;
@@ -230,6 +239,8 @@ OozebotEncoding OozebotEncoding::mate(OozebotEncoding &parent1, OozebotEncoding
         i++;
     }
     child.id = GlobalId++;
+    child.parentIds[0] = parent1.id;
+    child.parentIds[1] = parent2.id;
     child.globalTimeInterval = parent1.globalTimeInterval;
     return child;
 }
@@ -316,119 +327,241 @@ OozebotEncoding mutate(OozebotEncoding encoding) {
     return encoding;
 }
 
-void OozebotEncoding::evaluate(OozebotEncoding &encoding, double duration) {
+OozebotEncoding mutateControls(OozebotEncoding encoding) {
+    int r = randomInRange(0, 99);
+    double seed = randFloat() - 0.5; // -0.5 to 0.5
+    if (r < 10) {
+        double interval = encoding.globalTimeInterval + seed;
+        encoding.globalTimeInterval = std::min(std::max(interval, 2.0), 10.0);
+        return encoding;
+    }
+    int index = randomInRange(0, (int) (encoding.boxCommands.size() - 1));
+    r = randomInRange(0, 2);
+    if (r == 0) {
+        double a = encoding.boxCommands[index].a + seed * 0.1;
+        encoding.boxCommands[index].a = (float) std::min(std::max(a, 0.5), 1.5);
+    } else if (r == 1) {
+        // Box commands are kept sorted by b and springs refer to them by index - staying between the neighbours
+        // means no re-sort, which would reshuffle the robot's materials
+        double lowest = index + 1 < (int) encoding.boxCommands.size() ? encoding.boxCommands[index + 1].b : 0.0;
+        double highest = index > 0 ? encoding.boxCommands[index - 1].b : 0.6;
+        double b = encoding.boxCommands[index].b + seed * 0.05;
+        encoding.boxCommands[index].b = (float) std::min(std::max(b, lowest), highest);
+    } else {
+        double c = encoding.boxCommands[index].c + seed * 0.1;
+        encoding.boxCommands[index].c = (float) std::min(std::max(c, 0.0), 2 * M_PI);
+    }
+    return encoding;
+}
+
+// Displacement of the center of mass along the ground from the settled pose to the end, per second
+void scoreSimResult(OozebotEncoding &encoding, SimResult &result, double length) {
+    encoding.fitness = 0;
+    encoding.lengthAdj = 0;
+    if (!result.valid) {
+        return;
+    }
+    double mass = 0;
+    double startX = 0;
+    double startZ = 0;
+    for (auto it = result.startPoints.begin(); it != result.startPoints.end(); ++it) {
+        double pm = (*it).mass;
+        startX += (*it).x * pm;
+        startZ += (*it).z * pm;
+        mass += pm;
+    }
+    if (mass == 0) {
+        return;
+    }
+    double endX = 0;
+    double endZ = 0;
+    for (auto it = result.endPoints.begin(); it != result.endPoints.end(); ++it) {
+        if (isnan((*it).x) || isinf((*it).x) || isnan((*it).z) || isinf((*it).z)) {
+            printf("Solution has NaN or inf\n");
+            return;
+        }
+        double pm = (*it).mass;
+        endX += (*it).x * pm;
+        endZ += (*it).z * pm;
+    }
+    const double deltaX = (endX - startX) / mass;
+    const double deltaZ = (endZ - startZ) / mass;
+    double fitness = sqrt(deltaX * deltaX + deltaZ * deltaZ) / result.duration;
+    encoding.fitness = fitness;
+    encoding.lengthAdj = fitness / length;
+}
+
+EvaluationConfig evaluationConfig = kDefaultEvaluationConfig;
+
+void configureEvaluation(EvaluationConfig config) {
+    evaluationConfig = config;
+}
+
+EvaluationConfig currentEvaluationConfig() {
+    return evaluationConfig;
+}
+
+PendingEvaluation submitEvaluation(OozebotEncoding encoding, double duration, SimIntegrator integrator, ContactModel contact, PhysicsParameters physics) {
+    if (evaluationConfig.useLattice) {
+        SimInputs none;
+        return submitBuiltEvaluation(std::move(encoding), none, duration, integrator, contact, physics);
+    }
     SimInputs inputs = OozebotEncoding::inputsFromEncoding(encoding);
+    return submitBuiltEvaluation(std::move(encoding), inputs, duration, integrator, contact, physics);
+}
+
+PendingEvaluation submitBuiltEvaluation(OozebotEncoding encoding, SimInputs &inputs, double duration, SimIntegrator integrator, ContactModel contact, PhysicsParameters physics) {
+    PendingEvaluation pending;
+    pending.submittedAt = metricsClock();
+    pending.encoding = std::move(encoding);
+    pending.encoding.recording = NULL;
+    SimRequest request;
+    request.id = pending.encoding.id;
+    if (evaluationConfig.useLattice) {
+        releaseSimInputs(inputs); // the lattice engine lays the robot out its own way
+        request.lattice = std::make_shared<LatticeRobot>(OozebotEncoding::latticeFromEncoding(pending.encoding));
+        request.options = {kDefaultTimestep, integrator, contact, physics};
+        if (integrator != eulerIntegrator) {
+            request.options.dt = latticeStableTimestep(*request.lattice, contact, physics);
+        }
+        request.duration = duration;
+        request.oscillationFrequency = pending.encoding.globalTimeInterval;
+        for (auto it = pending.encoding.boxCommands.begin(); it != pending.encoding.boxCommands.end(); it++) {
+            request.presets.push_back({(*it).a, (*it).b, (*it).c});
+        }
+        pending.length = request.lattice->length;
+        pending.ticket = simBackend().submit(std::move(request));
+        return pending;
+    }
     int numPoints = inputs.points.size();
-    bool useCuda = false;// encoding.id % 16 < 6;
-    if (useCuda) {
-        AsyncSimHandle handle = createSimHandle(encoding.id, inputs.points.size(), inputs.springs.size());
-        simulate(handle, inputs.points, inputs.springs, inputs.springPresets, duration, encoding.globalTimeInterval);
-        double mass = 0;
-        double startX = 0;
-        double startZ = 0;
-        int numCycles = 1;
-        double oscillationDuration = 2 * M_PI / encoding.globalTimeInterval;
-        while ((oscillationDuration * numCycles + 1.0) < duration) {
-            numCycles += 1;
-        }
-        duration = (oscillationDuration * numCycles) + 1.0;
+    request.options = simOptionsForRobot(inputs.points, inputs.springs, integrator, contact, physics);
+    request.duration = duration;
+    request.oscillationFrequency = pending.encoding.globalTimeInterval;
+    if (evaluationConfig.recordTrajectory) {
+        std::vector<int> exterior;
         for (int i = 0; i < numPoints; i++) {
-            Point point = handle.startPoints[i];
-            double pm = point.mass;
-            startX += point.x * pm;
-            startZ += point.z * pm;
-            mass += pm;
-        }
-        startX = (startX / mass);
-        startZ = (startZ / mass);
-        bool invalid = false;
-        if (isinf(handle.duration) || mass == 0) {
-            invalid = true;
-        }
-        double endX = 0;
-        double endZ = 0;
-        for (int i = 0; i < numPoints; i++) {
-            Point point = handle.endPoints[i];
-            if (isnan(point.x) || isinf(point.x) || isnan(point.z) || isinf(point.z)) {
-                printf("Solution has NaN or inf\n");
-                invalid = true;
-                break;
+            if (inputs.points[i].numSprings != 26) {
+                exterior.push_back(i);
             }
-            double pm = point.mass;
-            endX += point.x * pm;
-            endX += point.z * pm;
-        }
-        if (invalid) {
-            encoding.fitness = 0;
-            encoding.lengthAdj = 0;
         }
-        else {
-            endX = endX / mass;
-            endZ = endZ / mass;
-            const double deltaX = endX - startX;
-            const double deltaZ = endZ - startZ;
-            double fitness = sqrt(deltaX * deltaX + deltaZ * deltaZ) / duration;
-            encoding.fitness = fitness;
-            encoding.lengthAdj = fitness / inputs.length;
+        // duration gets stretched by up to one oscillation
+        const double maxDuration = duration + 2 * M_PI / pending.encoding.globalTimeInterval;
+        request.observer = std::make_shared<SimObserver>(createSimObserver(kExportFrameInterval, maxDuration, exterior, true, true));
+    }
+    pending.recording = request.observer;
+    pending.length = inputs.length;
+    request.points = std::move(inputs.points);
+    request.springs = std::move(inputs.springs);
+    request.presets = std::move(inputs.springPresets);
+    releaseSimInputs(inputs);
+    pending.ticket = simBackend().submit(std::move(request));
+    return pending;
+}
+
+bool evaluationReady(PendingEvaluation &pending) {
+    return pending.ticket == NULL || pollSim(pending.ticket);
+}
+
+void finishEvaluation(PendingEvaluation &pending) {
+    if (pending.ticket != NULL) {
+        SimResult &result = waitForSim(pending.ticket);
+        if (result.valid) {
+            pending.encoding.recording = pending.recording;
         }
-        releaseSimHandle(handle);
+        scoreSimResult(pending.encoding, result, pending.length);
+        pending.encoding.evaluationSeconds = result.simulateSeconds;
+        pending.ticket = NULL; // frees the robot
     } else {
-        bool valid = simulateCPP(inputs.points, inputs.springs, inputs.springPresets, 1.0, encoding.globalTimeInterval);
-        if (!valid) {
-            encoding.fitness = 0;
-            encoding.lengthAdj = 0;
-            return;
-        }
-        double mass = 0;
-        double startX = 0;
-        double startZ = 0;
-        int numCycles = 1;
-        double oscillationDuration = 2 * M_PI / encoding.globalTimeInterval;
-        while ((oscillationDuration * numCycles + 1.0) < duration) {
-            numCycles += 1;
-        }
-        duration = (oscillationDuration * numCycles) + 1.0;
-        valid = simulateCPP(inputs.points, inputs.springs, inputs.springPresets, duration - 1.0, encoding.globalTimeInterval);
-        for (int i = 0; i < numPoints; i++) {
-            Point point = inputs.points[i];
-            double pm = point.mass;
-            startX += point.x * pm;
-            startZ += point.z * pm;
-            mass += pm;
-        }
-        startX = (startX / mass);
-        startZ = (startZ / mass);
-        bool invalid = false;
-        if (mass == 0) {
-            invalid = true;
-        }
-        double endX = 0;
-        double endZ = 0;
-        for (int i = 0; i < numPoints; i++) {
-            Point point = inputs.points[i];
-            if (isnan(point.x) || isinf(point.x) || isnan(point.z) || isinf(point.z)) {
-                printf("Solution has NaN or inf\n");
-                invalid = true;
-                break;
+        pending.encoding.evaluationSeconds = metricsClock() - pending.submittedAt; // simulated on the spot
+    }
+    recordLatency(simulatePhase, pending.encoding.evaluationSeconds);
+    countMetric(evaluationsCounter, 1);
+}
+
+void OozebotEncoding::evaluate(OozebotEncoding &encoding, double duration, SimIntegrator integrator, ContactModel contact, PhysicsParameters physics) {
+    PendingEvaluation pending = submitEvaluation(std::move(encoding), duration, integrator, contact, physics);
+    finishEvaluation(pending);
+    encoding = std::move(pending.encoding);
+}
+
+void evaluateControlVariants(std::vector<OozebotEncoding> &variants, double duration, SimIntegrator integrator, ContactModel contact, PhysicsParameters physics) {
+    if (variants.empty()) {
+        return;
+    }
+    const int lanes = kControlLanes;
+    SimInputs inputs = OozebotEncoding::inputsFromEncoding(variants[0]);
+    const SimOptions options = simOptionsForRobot(inputs.points, inputs.springs, integrator, contact, physics);
+    thread_local CompactSprings springs; // reused batch to batch
+    compactSprings(inputs.springs, springs);
+    std::vector<Point> points[kControlLanes];
+    std::vector<Point> startPoints[kControlLanes];
+    std::vector<FlexPreset> presets[kControlLanes];
+    for (int lane = 0; lane < lanes; lane++) {
+        points[lane] = acquireBuffer<Point>();
+        startPoints[lane] = acquireBuffer<Point>();
+        presets[lane] = acquireBuffer<FlexPreset>();
+    }
+    float frequencies[kControlLanes];
+    double durations[kControlLanes];
+    double ends[kControlLanes];
+    bool settled[kControlLanes];
+    bool intact[kControlLanes];
+    for (size_t first = 0; first < variants.size(); first += lanes) {
+        const int numVariants = (int) std::min(variants.size() - first, (size_t) lanes);
+        const double batchStart = metricsClock();
+        for (int lane = 0; lane < lanes; lane++) {
+            // Spare lanes in the last batch repeat its last variant rather than simulate garbage
+            OozebotEncoding &variant = variants[first + std::min(lane, numVariants - 1)];
+            points[lane].assign(inputs.points.begin(), inputs.points.end());
+            presets[lane].clear();
+            for (auto it = variant.boxCommands.begin(); it != variant.boxCommands.end(); it++) {
+                presets[lane].push_back({(*it).a, (*it).b, (*it).c});
             }
-            double pm = point.mass;
-            endX += point.x * pm;
-            endX += point.z * pm;
-        }
-        if (invalid) {
-            encoding.fitness = 0;
-            encoding.lengthAdj = 0;
-        }
-        else {
-            endX = endX / mass;
-            endZ = endZ / mass;
-            const double deltaX = endX - startX;
-            const double deltaZ = endZ - startZ;
-            double fitness = sqrt(deltaX * deltaX + deltaZ * deltaZ) / duration;
-            encoding.fitness = fitness;
-            encoding.lengthAdj = fitness / inputs.length;
+            frequencies[lane] = (float) variant.globalTimeInterval;
+            durations[lane] = stretchedDuration(duration, variant.globalTimeInterval);
+            ends[lane] = 1.0;
+        }
+        double phaseStart = metricsClock();
+        simulateControlLanesCPP(points, springs, presets, frequencies, ends, 0, options, settled);
+        traceSpanEvent("settle", phaseStart, metricsClock());
+        for (int lane = 0; lane < lanes; lane++) {
+            startPoints[lane].assign(points[lane].begin(), points[lane].end());
+            ends[lane] = settled[lane] ? durations[lane] - 1.0 : 0; // torn lanes finish straight away
+        }
+        phaseStart = metricsClock();
+        simulateControlLanesCPP(points, springs, presets, frequencies, ends, 0, options, intact);
+        traceSpanEvent("simulate", phaseStart, metricsClock());
+        const double batchSeconds = metricsClock() - batchStart;
+        for (int lane = 0; lane < numVariants; lane++) {
+            OozebotEncoding &variant = variants[first + lane];
+            SimResult result;
+            result.valid = settled[lane] && intact[lane];
+            result.duration = durations[lane];
+            result.startPoints.swap(startPoints[lane]);
+            result.endPoints.swap(points[lane]);
+            scoreSimResult(variant, result, inputs.length);
+            result.startPoints.swap(startPoints[lane]);
+            result.endPoints.swap(points[lane]);
+            variant.recording = NULL;
+            variant.evaluationSeconds = batchSeconds / numVariants; // wall time is shared by the whole batch
+            recordLatency(simulatePhase, variant.evaluationSeconds);
+            countMetric(evaluationsCounter, 1);
+            countMetric(springStepsCounter, (long long) (inputs.springs.size() * (durations[lane] / options.dt)));
         }
     }
+    for (int lane = 0; lane < lanes; lane++) {
+        releaseBuffer(points[lane]);
+        releaseBuffer(startPoints[lane]);
+        releaseBuffer(presets[lane]);
+    }
+    releaseSimInputs(inputs);
+}
+
+void releaseSimInputs(SimInputs &inputs) {
+    releaseBuffer(inputs.points);
+    releaseBuffer(inputs.springs);
+    releaseBuffer(inputs.springPresets);
+    releaseBuffer(inputs.originalPointIndex);
 }
 
 void layBlockAtPosition(
@@ -437,11 +570,12 @@ void layBlockAtPosition(
     int z,
     std::vector<Point> &points,
     std::vector<Spring> &springs,
-    std::map<Coordinate, int> &pointLocationToIndexMap,
-    std::map<std::pair<int, int>, bool> &pointIndexHasSpring,
+    PointIndexMap &pointLocationToIndexMap,
+    SpringSet &pointIndexHasSpring,
     OozebotExpression boxCommand,
     int idx) {
-    std::vector<int> pointIndices;
+    int pointIndices[8];
+    int numPointIndices = 0;
     // first make the points
     for (int xi = x; xi < x + 2; xi++) {
         for (int yi = y; yi < y + 2; yi++) {
@@ -453,13 +587,13 @@ void layBlockAtPosition(
                     Point p = {xi / 10.0f, yi / 10.0f, zi / 10.0f, 0, 0, 0, boxCommand.kg, boxCommand.uk, boxCommand.us, 0, 0};
                     points.push_back(p);
                 }
-                pointIndices.push_back(pointLocationToIndexMap[p]);
+                pointIndices[numPointIndices++] = pointLocationToIndexMap[p];
             }
         }
     }
     // now make the springs
-    for (int ii = 0; ii < pointIndices.size(); ii++) {
-        for (int jj = ii + 1; jj < pointIndices.size(); jj++) {
+    for (int ii = 0; ii < numPointIndices; ii++) {
+        for (int jj = ii + 1; jj < numPointIndices; jj++) {
             int first = std::min(pointIndices[ii], pointIndices[jj]);
             int second = std::max(pointIndices[ii], pointIndices[jj]);
             // always index from smaller to bigger so we don't have to double bookkeep
@@ -479,7 +613,7 @@ void layBlockAtPosition(
 
 int processExtremity(
     std::vector<OozebotExpression> &sequence,
-    std::map<Coordinate, std::pair<int, int>> &boxIndexSpringType,
+    SlotMap &boxIndexSpringType,
     int radius,
     OozebotAxis thicknessIgnoreAxis,
     int x,
@@ -583,7 +717,7 @@ int processExtremity(
     return globalMinY;
 }
 
-bool outOfBounds(std::map<Coordinate, std::pair<int, int>> &boxIndexSpringType, int x, int y, int z) {
+bool outOfBounds(SlotMap &boxIndexSpringType, int x, int y, int z) {
     if (boxIndexSpringType.find({x, y, z}) == boxIndexSpringType.end()) {
         return true;
     }
@@ -592,8 +726,8 @@ bool outOfBounds(std::map<Coordinate, std::pair<int, int>> &boxIndexSpringType,
 
 int processExtremityWithAnchor(
     std::vector<OozebotExpression> &sequence,
-    std::map<Coordinate, std::pair<int, int>> &bodyIndexSpringType,
-    std::map<Coordinate, std::pair<int, int>> &boxIndexSpringType,
+    SlotMap &bodyIndexSpringType,
+    SlotMap &boxIndexSpringType,
     int radius,
     OozebotAxis thicknessIgnoreAxis,
     double anchorX,
@@ -653,18 +787,91 @@ int processExtremityWithAnchor(
         invertZ);
 }
 
-SimInputs OozebotEncoding::inputsFromEncoding(OozebotEncoding &encoding) {
-    std::vector<Point> points;
-    std::vector<Spring> springs;
-    std::vector<FlexPreset> presets;
+// Interleaves the bits of the lattice coordinates so points close in space get close indices
+unsigned int mortonKey(int x, int y, int z) {
+    unsigned int key = 0;
+    // Coordinates are clamped to [-100, 100] plus the block's far corner, so shifting by 128 fits 8 bits
+    unsigned int ux = (unsigned int) (x + 128);
+    unsigned int uy = (unsigned int) (y + 128);
+    unsigned int uz = (unsigned int) (z + 128);
+    for (int bit = 0; bit < 8; bit++) {
+        key |= ((ux >> bit) & 1) << (3 * bit + 2);
+        key |= ((uy >> bit) & 1) << (3 * bit + 1);
+        key |= ((uz >> bit) & 1) << (3 * bit);
+    }
+    return key;
+}
 
-    for (auto it = encoding.boxCommands.begin(); it != encoding.boxCommands.end(); it++) {
-        FlexPreset p = {(*it).a, (*it).b, (*it).c};
-        presets.push_back(p);
+// Renumbers points in Morton order and sorts springs by flex preset, then by endpoints, so the spring pass walks
+// memory mostly forwards. Returns each point's original index
+std::vector<int> reorderForLocality(std::vector<Point> &points, std::vector<Spring> &springs, PointIndexMap &pointLocationToIndexMap) {
+    ArenaVector<std::pair<unsigned int, int>> keys;
+    keys.reserve(points.size());
+    for (auto it = pointLocationToIndexMap.begin(); it != pointLocationToIndexMap.end(); ++it) {
+        keys.push_back({mortonKey((*it).first.x, (*it).first.y, (*it).first.z), (*it).second});
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<int> originalIndex = acquireBuffer<int>();
+    originalIndex.resize(points.size());
+    ArenaVector<int> newIndex(points.size());
+    std::vector<Point> sortedPoints = acquireBuffer<Point>();
+    sortedPoints.reserve(points.size());
+    for (int i = 0; i < keys.size(); i++) {
+        originalIndex[i] = keys[i].second;
+        newIndex[keys[i].second] = i;
+        Point p = points[keys[i].second];
+        p.numSprings = 0; // recounted below to hand out the per point spring indices in the new order
+        sortedPoints.push_back(p);
+    }
+
+    ArenaVector<int> springOrder(springs.size());
+    for (int i = 0; i < springOrder.size(); i++) {
+        springOrder[i] = i;
+    }
+    std::sort(springOrder.begin(), springOrder.end(), [&](int a, int b) {
+        const int aFirst = std::min(newIndex[springs[a].p1], newIndex[springs[a].p2]);
+        const int bFirst = std::min(newIndex[springs[b].p1], newIndex[springs[b].p2]);
+        const int aSecond = std::max(newIndex[springs[a].p1], newIndex[springs[a].p2]);
+        const int bSecond = std::max(newIndex[springs[b].p1], newIndex[springs[b].p2]);
+        if (springs[a].flexIndex != springs[b].flexIndex) {
+            return springs[a].flexIndex < springs[b].flexIndex;
+        }
+        if (aFirst != bFirst) {
+            return aFirst < bFirst;
+        }
+        return aSecond < bSecond;
+    });
+    std::vector<Spring> sortedSprings = acquireBuffer<Spring>();
+    sortedSprings.reserve(springs.size());
+    for (auto it = springOrder.begin(); it != springOrder.end(); ++it) {
+        Spring s = springs[*it];
+        // always index from smaller to bigger
+        const int first = std::min(newIndex[s.p1], newIndex[s.p2]);
+        const int second = std::max(newIndex[s.p1], newIndex[s.p2]);
+        Spring sorted = {s.k, first, second, s.l0, sortedPoints[first].numSprings, sortedPoints[second].numSprings, s.flexIndex};
+        sortedSprings.push_back(sorted);
+        sortedPoints[first].numSprings += 1;
+        sortedPoints[second].numSprings += 1;
     }
 
+    points.swap(sortedPoints);
+    springs.swap(sortedSprings);
+    releaseBuffer(sortedPoints);
+    releaseBuffer(sortedSprings);
+    return originalIndex;
+}
+
+struct BlockLayout {
     // x -> y -> z -> (distance, box_index)
-    std::map<Coordinate, std::pair<int, int>> bodyIndexSpringType;
+    SlotMap bodyIndexSpringType;
+    SlotMap extremityIndexSpringType;
+    int minY;
+};
+
+// Which box goes in each lattice slot - the body is laid first, then the extremities
+BlockLayout layoutFromEncoding(OozebotEncoding &encoding) {
+    SlotMap bodyIndexSpringType;
     int minY = processExtremity(
         encoding.layAndMoveCommands[encoding.bodyCommand.layAndMoveIdx],
         bodyIndexSpringType,
@@ -676,7 +883,7 @@ SimInputs OozebotEncoding::inputsFromEncoding(OozebotEncoding &encoding) {
         false,
         false,
         false);
-    std::map<Coordinate, std::pair<int, int>> extremityIndexSpringType;
+    SlotMap extremityIndexSpringType;
     bool invertX = false;
     bool invertY = false;
     bool invertZ = false;
@@ -716,11 +923,30 @@ SimInputs OozebotEncoding::inputsFromEncoding(OozebotEncoding &encoding) {
             invertZ = false;
         }
     }
+    return { bodyIndexSpringType, extremityIndexSpringType, minY };
+}
+
+SimInputs OozebotEncoding::inputsFromEncoding(OozebotEncoding &encoding) {
+    TRACE_SPAN("phenotype build");
+    ArenaScope scope;
+    std::vector<Point> points = acquireBuffer<Point>();
+    std::vector<Spring> springs = acquireBuffer<Spring>();
+    std::vector<FlexPreset> presets = acquireBuffer<FlexPreset>();
+
+    for (auto it = encoding.boxCommands.begin(); it != encoding.boxCommands.end(); it++) {
+        FlexPreset p = {(*it).a, (*it).b, (*it).c};
+        presets.push_back(p);
+    }
+
+    BlockLayout layout = layoutFromEncoding(encoding);
+    SlotMap &bodyIndexSpringType = layout.bodyIndexSpringType;
+    SlotMap &extremityIndexSpringType = layout.extremityIndexSpringType;
+    int minY = layout.minY;
 
     // All indexes are points in 3 space times 10 (position on tenth of a meter, index by integer)
     // Largest value is 100, smallest is -100 on each axis
-    std::map<Coordinate, int> pointLocationToIndexMap;
-    std::map<std::pair<int, int>, bool> pointIndexHasSpring;
+    PointIndexMap pointLocationToIndexMap;
+    SpringSet pointIndexHasSpring;
 
     // Now we have priority of each material for each slot so we can lay the body
     for (auto iter = bodyIndexSpringType.begin(); iter != bodyIndexSpringType.end(); iter++) {
@@ -751,6 +977,8 @@ SimInputs OozebotEncoding::inputsFromEncoding(OozebotEncoding &encoding) {
             boxIndex);
     }
 
+    std::vector<int> originalPointIndex = reorderForLocality(points, springs, pointLocationToIndexMap);
+
     float smallestX = 100;
     float largestX = -100;
     float smallestY = 100;
@@ -769,5 +997,25 @@ SimInputs OozebotEncoding::inputsFromEncoding(OozebotEncoding &encoding) {
     }
     double length = (double) std::max(std::max(largestX - smallestX, largestY - smallestY), largestZ - smallestZ);
 
-    return { points, springs, presets, length };
+    return { std::move(points), std::move(springs), std::move(presets), length, std::move(originalPointIndex) };
+}
+
+LatticeRobot OozebotEncoding::latticeFromEncoding(OozebotEncoding &encoding) {
+    TRACE_SPAN("phenotype build");
+    ArenaScope scope;
+    std::vector<LatticeMaterial> materials;
+    for (auto it = encoding.boxCommands.begin(); it != encoding.boxCommands.end(); it++) {
+        materials.push_back({(*it).kg, (*it).uk, (*it).us, (*it).k, (int) (it - encoding.boxCommands.begin())});
+    }
+
+    BlockLayout layout = layoutFromEncoding(encoding);
+    // Same lay order as inputsFromEncoding so shared points and springs get the same material
+    std::vector<LatticeVoxel> voxels;
+    for (auto iter = layout.bodyIndexSpringType.begin(); iter != layout.bodyIndexSpringType.end(); iter++) {
+        voxels.push_back({(*iter).first.x, (*iter).first.y, (*iter).first.z, iter->second.second});
+    }
+    for (auto iter = layout.extremityIndexSpringType.begin(); iter != layout.extremityIndexSpringType.end(); iter++) {
+        voxels.push_back({(*iter).first.x, (*iter).first.y, (*iter).first.z, iter->second.second});
+    }
+    return createLatticeRobot(voxels, materials, layout.minY);
 }
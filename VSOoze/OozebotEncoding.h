@@ -2,7 +2,10 @@
 #define OOZEBOT_ENCODING_H
 
 #include <vector>
+#include <memory>
 #include "cppSim.h"
+#include "latticeSim.h"
+#include "SimBackend.h"
 
 enum OozebotExpressionType {
     boxDeclaration, // combination of springs and masses - one size mass (kg), and spring config for all springs (k, a, b, c)
@@ -51,26 +54,45 @@ public:
     double anchorZ;
 };
 
+// Genome size limits - every encoding fits in these
+const int kNumBoxes = 4;
+const int kMaxLayAndMoveSequences = 4;
+const int kMaxLayAndMoveLength = 8;
+const int kMaxGrowthCommands = 6;
+const int kMaxRadius = 3;
+
+const double kExportFrameInterval = 1.0 / 24.0; // 24fps
+
 struct SimInputs {
     std::vector<Point> points;
     std::vector<Spring> springs;
     std::vector<FlexPreset> springPresets;
     double length;
+    std::vector<int> originalPointIndex; // points are reordered for locality - this is each one's index in construction order
 };
 
+// inputsFromEncoding's buffers come from the BufferPools - hand them back once done with so the next robot reuses them
+void releaseSimInputs(SimInputs &inputs);
+
 class OozebotEncoding {
 public:
     double fitness; // Depends on objective - might be net displacement
     double lengthAdj; // Fitness normalized for maximum dimension cross section
     double globalTimeInterval; // 2 - 10
     unsigned long int id;
+    unsigned long int parentIds[2]; // 0 if there's no such parent - random encodings have none, mutants just one
+    double evaluationSeconds; // wall time the last evaluate spent simulating, not counting any wait for a worker
+    std::shared_ptr<SimObserver> recording; // what the last evaluate observed, if it was asked to record - the front drops it once it's exported
 
     static OozebotEncoding mate(OozebotEncoding &parent1, OozebotEncoding &parent2);
 
     static SimInputs inputsFromEncoding(OozebotEncoding &encoding);
 
-    // Sync on the handle to get the result
-    static void evaluate(OozebotEncoding &encoding, double duration);
+    // Same robot as inputsFromEncoding for the lattice engine
+    static LatticeRobot latticeFromEncoding(OozebotEncoding &encoding);
+
+    // Blocks until simBackend() has simulated it - submitEvaluation and finishEvaluation are the same thing split up
+    static void evaluate(OozebotEncoding &encoding, double duration, SimIntegrator integrator = eulerIntegrator, ContactModel contact = penaltyContact, PhysicsParameters physics = kDefaultPhysics);
 
     static OozebotEncoding randomEncoding();
 
@@ -83,10 +105,53 @@ public:
 
 OozebotEncoding mutate(OozebotEncoding encoding);
 
+// mutate restricted to the controls - box a, b, c and globalTimeInterval - so the child keeps its parent's morphology
+OozebotEncoding mutateControls(OozebotEncoding encoding);
+
+// How submitEvaluation simulates robots, alongside the integrator and contact model it's passed
+struct EvaluationConfig {
+    bool useLattice; // lattice-native engine on the backend's workers - same physics without spring arrays
+    bool recordTrajectory; // keeps the exterior at export frame rate so front entries don't get simulated again
+};
+
+const EvaluationConfig kDefaultEvaluationConfig = {false, false};
+
+// Call before any evaluation is running
+void configureEvaluation(EvaluationConfig config);
+
+EvaluationConfig currentEvaluationConfig();
+
+// An evaluation handed to simBackend(). The phenotype is built on the submitting thread, the simulation happens on
+// a backend worker and finishEvaluation scores it - the caller is free in between
+struct PendingEvaluation {
+    OozebotEncoding encoding; // fitness is filled in by finishEvaluation
+    SimTicket ticket; // NULL once finished, or if it was simulated on the spot
+    std::shared_ptr<SimObserver> recording;
+    double length;
+    double submittedAt;
+};
+
+// Move the encoding in unless the caller still needs it - pending.encoding is what comes back scored
+PendingEvaluation submitEvaluation(OozebotEncoding encoding, double duration, SimIntegrator integrator = eulerIntegrator, ContactModel contact = penaltyContact, PhysicsParameters physics = kDefaultPhysics);
+
+// submitEvaluation for a phenotype already made by inputsFromEncoding, so it isn't built twice. Takes over inputs' buffers
+PendingEvaluation submitBuiltEvaluation(OozebotEncoding encoding, SimInputs &inputs, double duration, SimIntegrator integrator = eulerIntegrator, ContactModel contact = penaltyContact, PhysicsParameters physics = kDefaultPhysics);
+
+// Never blocks
+bool evaluationReady(PendingEvaluation &pending);
+
+// Blocks until the simulation is done
+void finishEvaluation(PendingEvaluation &pending);
+
+// For encodings that differ only in their controls, like mutateControls children of one parent. They share the
+// first one's morphology and are simulated kControlLanes at a time on the calling thread instead of one per backend
+// worker. Each is scored in place with the fitness evaluate would give it
+void evaluateControlVariants(std::vector<OozebotEncoding> &variants, double duration, SimIntegrator integrator = eulerIntegrator, ContactModel contact = penaltyContact, PhysicsParameters physics = kDefaultPhysics);
+
 unsigned long int newGlobalID();
 
 // Returns true if the first encoding dominates the second, false otherwise
-inline bool dominates(OozebotEncoding firstEncoding, OozebotEncoding secondEncoding) {
+inline bool dominates(const OozebotEncoding &firstEncoding, const OozebotEncoding &secondEncoding) {
     return firstEncoding.fitness >= secondEncoding.fitness && firstEncoding.lengthAdj >= secondEncoding.lengthAdj;
 }
 
@@ -11,8 +11,12 @@
 
 #include "ParetoFront.h"
 #include "cppSim.h"
+#include "Metrics.h"
+#include "Trace.h"
 
 void logEncoding(OozebotEncoding &encoding) {
+    TRACE_SPAN("log");
+    const double start = metricsClock();
     printf("New encoding on pareto front: %d with fitness: %f length adj: %f\n", encoding.id, encoding.fitness, encoding.lengthAdj);
     std::map<int, int> exteriorPoints = {};
     // We now log this to report - should this be here? Maybe not, but the async is annoying.
@@ -53,10 +57,37 @@ void logEncoding(OozebotEncoding &encoding) {
     }
     myfile << "],\n";
     myfile << "\"simulation\" : [\n";
+    if (encoding.recording != NULL) {
+        // Captured while it was evaluated - same points in the same order as the exterior above
+        SimObserver &recording = *encoding.recording;
+        const int numTracked = (int) recording.trackedPoints.size();
+        for (int frame = 0; frame < recording.numSamples; frame++) {
+            myfile << "[\n";
+            for (int j = 0; j < numTracked; j++) {
+                if (j != 0) {
+                    myfile << ",";
+                }
+                const float *p = &recording.trajectory[3 * (frame * numTracked + j)];
+                myfile << "[ " + std::to_string(p[0]) + ", " + std::to_string(p[2]) + ", " + std::to_string(p[1]) + "]";
+            }
+            myfile << (frame + 1 < recording.numSamples ? "],\n" : "]\n");
+        }
+        myfile << "]\n";
+        myfile << "}";
+        myfile.close();
+        recordLatency(logPhase, metricsClock() - start);
+        return;
+    }
+    if (currentEvaluationConfig().recordTrajectory && encoding.fitness > 0) {
+        // Only torn robots (which score 0) come back without one - anything else means a path that doesn't record
+        printf("Robot %lu was evaluated without a recording - simulating it again to export\n", encoding.id);
+    }
+    countMetric(frontReplaysCounter, 1);
     double t = 0;
-    double dt = 1.0 / 24.0; // 24fps
+    double dt = kExportFrameInterval;
     //simulate(handle, inputs.points, inputs.springs, inputs.springPresets, 0, encoding.globalTimeInterval); // 0s to just capture initial conditions
     double simDuration = 30.0;
+    CompactSprings springs = compactSprings(inputs.springs);
     while (t < simDuration) {
         myfile << "[\n";
         first = true;
@@ -75,17 +106,54 @@ void logEncoding(OozebotEncoding &encoding) {
             myfile << "]\n";
         } else {
             myfile << "],\n";
-            simulateAgainCPP(inputs.points, inputs.springs, inputs.springPresets, dt + t, t, encoding.globalTimeInterval);
+            simulateCompactCPP(inputs.points, springs, inputs.springPresets, dt + t, t, encoding.globalTimeInterval);
         }
         t += dt;
     }
     myfile << "]\n";
     myfile << "}";
     myfile.close();
+    recordLatency(logPhase, metricsClock() - start);
     //releaseSimHandle(handle);
 }
 
-bool ParetoFront::evaluateEncoding(OozebotEncoding &encoding) {
+// Scratch for comparing against the front - one set per inserting thread
+thread_local std::vector<unsigned char> frontCandidateCovers;
+thread_local std::vector<unsigned char> frontMemberCovers;
+
+// Also leaves frontCandidateCovers set for every member the candidate covers
+bool coveredByFront(const ParetoSnapshot &front, const Objectives &candidate) {
+    const int frontSize = front.objectives.size();
+    front.objectives.compare(candidate, frontSize, frontCandidateCovers, frontMemberCovers);
+    for (int i = 0; i < frontSize; i++) {
+        if (frontMemberCovers[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+ParetoFront::ParetoFront():front(std::make_shared<ParetoSnapshot>()) {}
+
+std::shared_ptr<const ParetoSnapshot> ParetoFront::snapshot() {
+    std::shared_ptr<const ParetoSnapshot> current = std::atomic_load(&this->front);
+    std::lock_guard<std::mutex> lock(this->noveltyMutex);
+    if (this->noveltySnapshot != NULL && this->noveltySnapshot->members == current->members
+        && this->noveltySnapshot->noveltyVersion == (long) this->allResults.size()) {
+        return this->noveltySnapshot;
+    }
+    // Members are shared with the published front - only the histogram is copied
+    std::shared_ptr<ParetoSnapshot> next = std::make_shared<ParetoSnapshot>(*current);
+    next->buckets = this->buckets;
+    next->lengthAdjBucketSize = this->lengthAdjBucketSize;
+    next->fitnessBucketSize = this->fitnessBucketSize;
+    next->noveltyVersion = (long) this->allResults.size();
+    this->noveltySnapshot = next;
+    return next;
+}
+
+void ParetoFront::recordNovelty(OozebotEncoding &encoding) {
+    std::lock_guard<std::mutex> lock(this->noveltyMutex);
     this->allResults.push_back({encoding.lengthAdj, encoding.fitness});
     int lengthAdjBucket = (int) round(encoding.lengthAdj / this->lengthAdjBucketSize);
 
@@ -108,22 +176,57 @@ bool ParetoFront::evaluateEncoding(OozebotEncoding &encoding) {
     if (lastResize < this->allResults.size() / 2) {
         this->resize();
     }
-    auto iter = this->encodingFront.begin();
-    while (iter != this->encodingFront.end()) {
-        auto frontEncoding = *iter;
+    setGauge(noveltyResultsGauge, this->allResults.size());
+}
 
-        if (dominates(frontEncoding, encoding)) {
-            return false; // this is dominated by an existing one - by definition it can't dominate any others
-        } else if (dominates(encoding, frontEncoding)) {
-            iter = this->encodingFront.erase(iter); // this dominates one - it will certainly be added but also may dominate others
-        } else {
-            ++iter;
+bool ParetoFront::evaluateEncoding(OozebotEncoding &encoding) {
+    TRACE_SPAN("collect");
+    const double start = metricsClock();
+    // The trajectory is only worth its memory until a front member is exported - nothing that comes back out of here
+    // (the selector, the snapshot members) keeps one
+    std::shared_ptr<SimObserver> recording = std::move(encoding.recording);
+    encoding.recording = NULL;
+    this->recordNovelty(encoding);
+
+    Objectives objectives = objectivesForEncoding(encoding);
+    // Whatever covers the candidate in an old snapshot is either still on the front or was pushed off by something
+    // at least as good, so most candidates are turned away without taking the lock
+    std::shared_ptr<const ParetoSnapshot> current = std::atomic_load(&this->front);
+    bool dominated = coveredByFront(*current, objectives);
+    int frontSize = current->objectives.size();
+    if (!dominated) {
+        std::lock_guard<std::mutex> lock(this->frontMutex);
+        current = std::atomic_load(&this->front);
+        frontSize = current->objectives.size();
+        dominated = coveredByFront(*current, objectives);
+        if (!dominated) {
+            // Copy on write - members are shared with the old snapshot, only the ones the candidate covers are dropped
+            std::shared_ptr<ParetoSnapshot> next = std::make_shared<ParetoSnapshot>();
+            for (int i = 0; i < frontSize; i++) {
+                if (!frontCandidateCovers[i]) {
+                    next->members.push_back(current->members[i]);
+                    next->objectives.push_back(objectivesForEncoding(*current->members[i]));
+                }
+            }
+            next->members.push_back(std::make_shared<const OozebotEncoding>(encoding));
+            next->objectives.push_back(objectives);
+            frontSize = next->objectives.size();
+            std::atomic_store(&this->front, std::shared_ptr<const ParetoSnapshot>(next));
         }
     }
+    if (this->evaluationLog != NULL) {
+        std::lock_guard<std::mutex> lock(this->logMutex);
+        appendEvaluation(*this->evaluationLog, encoding, dominated ? dominatedOnArrival : madeFront);
+    }
+    setGauge(frontSizeGauge, frontSize);
+    recordLatency(collectPhase, metricsClock() - start);
+    if (dominated) {
+        return false;
+    }
 
-    this->encodingFront.push_back(encoding);
-    std::thread(logEncoding, encoding).detach();
-
+    OozebotEncoding exported = encoding;
+    exported.recording = std::move(recording); // dropped along with the thread's copy once it's written out
+    std::thread(logEncoding, exported).detach();
     return true;
 }
 
@@ -150,8 +253,8 @@ void ParetoFront::resize() {
     }
 }
 
-double ParetoFront::noveltyDegreeForEncoding(OozebotEncoding encoding) {
+double ParetoSnapshot::noveltyDegree(const OozebotEncoding &encoding) const {
     int lengthAdjBucket = (int) round(encoding.lengthAdj / this->lengthAdjBucketSize);
     int fitnessBucket = (int) round(encoding.fitness / this->fitnessBucketSize);
-    return (double) 1 / this->buckets[lengthAdjBucket][fitnessBucket];  
+    return (double) 1 / this->buckets[lengthAdjBucket][fitnessBucket];
 }
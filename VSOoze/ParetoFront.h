@@ -1,23 +1,53 @@
 #ifndef PARETO_FRONT_H
 #define PARETO_FRONT_H
 
+#include <memory>
+#include <mutex>
 #include <utility>
 #include <vector>
 
 #include "OozebotEncoding.h"
+#include "ObjectiveSet.h"
+#include "Surrogate.h"
+#include "EvaluationLog.h"
 
 void logEncoding(OozebotEncoding &encoding);
 
+// Immutable view of the front - readers can hold on to one for as long as they like while inserts publish new ones
+struct ParetoSnapshot {
+    std::vector<std::shared_ptr<const OozebotEncoding>> members;
+    ObjectiveSet objectives; // same order as members
+
+    // Histogram of every result so far, as of when the snapshot was taken
+    std::vector<std::vector<int>> buckets;
+    double lengthAdjBucketSize;
+    double fitnessBucketSize;
+    long noveltyVersion; // results recorded when the buckets were copied
+
+    // 1 if very novel, asymptotes to 0 as it's less novel
+    double noveltyDegree(const OozebotEncoding &encoding) const;
+};
+
+// Every method is thread safe so workers can insert their results directly
 class ParetoFront {
 public:
+    Surrogate *surrogate = NULL; // optional - screens children before they're simulated
+    EvaluationLog *evaluationLog = NULL; // optional - every evaluation gets appended
+
+    ParetoFront();
+
     // This functions will add the evaluated encoding and invalidate others appropriately
     bool evaluateEncoding(OozebotEncoding &encoding);
 
-    // 1 if very novel, asymptotes to 0 as it's less novel
-    double noveltyDegreeForEncoding(OozebotEncoding encoding);
+    // The front and novelty as they stand - selection reads everything from one so it sees a consistent population.
+    // Only waits on recording an evaluation's novelty, never on front inserts
+    std::shared_ptr<const ParetoSnapshot> snapshot();
 
 private:
-    std::vector<OozebotEncoding> encodingFront;
+    std::shared_ptr<const ParetoSnapshot> front; // only swapped with std::atomic_store
+    std::mutex frontMutex; // held while building the next snapshot, never by readers
+    std::mutex noveltyMutex; // guards allResults, the buckets and noveltySnapshot
+    std::mutex logMutex; // the evaluation log has a single writer
     std::vector<std::pair<double, double>> allResults;
     std::vector<std::vector<int>> buckets;
     double lengthAdjBucketSize = 0.1;
@@ -25,8 +55,10 @@ private:
     double maxLengthAdj = 0.01;
     double maxFitness = 0.01;
     int lastResize = 10;
+    std::shared_ptr<const ParetoSnapshot> noveltySnapshot; // last handed out - reused while nothing has changed
 
     void resize();
+    void recordNovelty(OozebotEncoding &encoding);
 };
 
 #endif
\ No newline at end of file
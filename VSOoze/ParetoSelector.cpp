@@ -1,11 +1,12 @@
 #include "ParetoSelector.h"
 #include "OozebotEncoding.h"
 #include "ParetoFront.h"
+#include "Pipeline.h"
+#include "Metrics.h"
+#include "Trace.h"
 #include <vector>
 #include <algorithm>
 #include <stdio.h>
-#include <future>
-#include <thread>
 
 // M: # of objectives/dimensions in the pareto front
 // N: Size of generation
@@ -14,44 +15,58 @@ bool sortFunction(OozebotSortWrapper a, OozebotSortWrapper b) {
     return (a.novelty > b.novelty);
 }
 
-// Insertion is O(M * N) plus cost of sort - O(N^2) - plus cost of tracking globally O(K)
-void ParetoSelector::insertOozebot(OozebotEncoding &encoding) {
-    OozebotSortWrapper wrapper = {encoding, {}, {}, 0, 0};
-
-    for (std::vector<OozebotSortWrapper>::iterator iter = this->generation.begin(); iter != this->generation.end(); iter++) {
-        if (dominates(encoding, (*iter).encoding)) {
-            (*iter).dominated.push_back(encoding.id);
-            (*iter).dominationDegree += 1;
-            wrapper.dominating.push_back((*iter).encoding.id);
-        } else if (dominates((*iter).encoding, encoding)) {
-            wrapper.dominated.push_back((*iter).encoding.id);
+void ParetoSelector::linkDominance(int index) {
+    OozebotSortWrapper &wrapper = this->generation[index];
+    this->objectives.compare(objectivesForEncoding(wrapper.encoding), index, this->candidateCovers, this->memberCovers);
+    for (int i = 0; i < index; i++) {
+        OozebotSortWrapper &other = this->generation[i];
+        if (this->candidateCovers[i]) {
+            other.dominated.push_back(wrapper.encoding.id);
+            other.dominationDegree += 1;
+            wrapper.dominating.push_back(other.encoding.id);
+        } else if (this->memberCovers[i]) {
+            wrapper.dominated.push_back(other.encoding.id);
             wrapper.dominationDegree += 1;
-            (*iter).dominating.push_back(encoding.id);
+            other.dominating.push_back(wrapper.encoding.id);
         }
     }
+}
+
+// Insertion is O(M * N) plus cost of sort - O(N^2) - plus cost of tracking globally O(K)
+void ParetoSelector::insertOozebot(OozebotEncoding &encoding) {
+    TRACE_SPAN("pareto insert");
     this->idToIndex[encoding.id] = (int) this->generation.size();
-    this->generation.push_back(wrapper);
+    this->generation.push_back({encoding, {}, {}, 0, 0});
+    this->objectives.push_back(objectivesForEncoding(encoding));
+    this->linkDominance((int) this->generation.size() - 1);
+}
+
+void ParetoSelector::insertOozebots(std::vector<OozebotEncoding> &encodings) {
+    TRACE_SPAN("pareto insert");
+    const int start = (int) this->generation.size();
+    this->generation.reserve(start + encodings.size());
+    for (auto it = encodings.begin(); it != encodings.end(); ++it) {
+        this->idToIndex[(*it).id] = (int) this->generation.size();
+        this->generation.push_back({*it, {}, {}, 0, 0});
+        this->objectives.push_back(objectivesForEncoding(*it));
+    }
+    for (int i = start; i < this->generation.size(); i++) {
+        this->linkDominance(i);
+    }
 }
 
 void ParetoSelector::removeAllOozebots() {
     this->generation.clear();
+    this->objectives.clear();
     this->idToIndex.clear();
 }
 
-OozebotEncoding gen(OozebotEncoding &mom, OozebotEncoding &dad, bool shouldMutate, double duration) {
-    OozebotEncoding child = OozebotEncoding::mate(mom, dad);
-    if (shouldMutate) {
-        child = mutate(child);
-    }
-    OozebotEncoding::evaluate(child, duration);
-    return child;
-}
-
 // Crowding is maintained by dividing the entire
 // search space deterministically in subspaces, where is the
 // depth parameter and is the number of decision variables, and
 // by updating the subspaces dynamically
 int ParetoSelector::selectAndMate(double duration) {
+    TRACE_INSTANT("generation start");
     this->sort();
 
     std::vector<OozebotEncoding> newGeneration = {
@@ -62,47 +77,44 @@ int ParetoSelector::selectAndMate(double duration) {
         this->generation[4].encoding
     };
 
-    std::future<OozebotEncoding> threads[NUM_THREADS];
-
-    int k, l;
-    for (int i = 0; i < NUM_THREADS; i++) {
-        k = this->selectionIndex();
-        l = this->selectionIndex();
+    // Sized to the whole generation and filled before anything is collected - the backend only runs costliest first
+    // among robots it's been handed, and the stragglers are what a generation waits on
+    const int numChildren = this->generationSize - 5;
+    EvaluationPipeline pipeline(duration, this->globalParetoFront, numChildren);
+    for (int i = 0; i < numChildren; i++) {
+        int k = this->selectionIndex();
+        int l = this->selectionIndex();
         while (k == l) {
             l = this->selectionIndex();
         }
-        threads[i] = std::async(&gen, this->generation[k].encoding, this->generation[l].encoding, ((double) rand() / RAND_MAX) < this->mutationProbability, duration);
-    }
-    
-    int j = 0;
-    for (int i = 0; i < this->generationSize - 5; i++) {
-        OozebotEncoding encoding = threads[j].get();
-        this->globalParetoFront->evaluateEncoding(encoding);
-        newGeneration.push_back(encoding);
-
-        if (i < this->generationSize - 6) {
-            if (i < this->generationSize - 5 - NUM_THREADS) {
-                k = this->selectionIndex();
-                l = this->selectionIndex();
-                while (k == l) {
-                    l = this->selectionIndex();
-                }
-                threads[j] = std::async(&gen, this->generation[k].encoding, this->generation[l].encoding, ((double) rand() / RAND_MAX) < this->mutationProbability, duration);
+        OozebotEncoding mom = this->generation[k].encoding;
+        OozebotEncoding dad = this->generation[l].encoding;
+        bool shouldMutate = ((double) rand() / RAND_MAX) < this->mutationProbability;
+        pipeline.submit([mom, dad, shouldMutate]() mutable {
+            OozebotEncoding child = OozebotEncoding::mate(mom, dad);
+            if (shouldMutate) {
+                child = mutate(child);
             }
-            j = (j + 1) % NUM_THREADS;
-        }
+            return child;
+        });
+    }
+    for (int i = 0; i < numChildren; i++) {
+        newGeneration.push_back(pipeline.next()); // already on the global front
     }
 
     this->removeAllOozebots();
-    for (auto oozebot : newGeneration) {
-        this->insertOozebot(oozebot);
-    }
+    this->insertOozebots(newGeneration);
+    TRACE_INSTANT("generation end");
 
     return this->generationSize - 5;
 }
 
 // Sort is O(N^2)
 void ParetoSelector::sort() {
+    TRACE_SPAN("sort");
+    const double start = metricsClock();
+    // Novelty changes as evaluations come in - one snapshot keeps every member scored against the same results
+    std::shared_ptr<const ParetoSnapshot> front = this->globalParetoFront->snapshot();
     std::vector<std::vector<OozebotSortWrapper>> workingVec;
     int numLeft = (int) this->generationSize;
     while (numLeft > 0) {
@@ -110,7 +122,7 @@ void ParetoSelector::sort() {
         for (std::vector<OozebotSortWrapper>::iterator iter = this->generation.begin(); iter != this->generation.end(); iter++) {
             if ((*iter).dominationDegree == 0) {
                 (*iter).dominationDegree -= 1; // invalidates it for the rest of iterations
-                (*iter).novelty = this->globalParetoFront->noveltyDegreeForEncoding((*iter).encoding); // These get stale so must recompute
+                (*iter).novelty = front->noveltyDegree((*iter).encoding); // These get stale so must recompute
                 nextTier.push_back(*iter);
             }
         }
@@ -129,12 +141,14 @@ void ParetoSelector::sort() {
         }
     }
     this->idToIndex.clear();
+    this->objectives.clear();
     std::vector<OozebotSortWrapper> nextGeneration;
     nextGeneration.reserve(this->generationSize);
     for (auto it = workingVec.begin(); it != workingVec.end(); ++it) {
         for (auto iter = (*it).begin(); iter != (*it).end(); ++iter) {
             (*iter).dominationDegree = (int) (*iter).dominated.size();
             this->idToIndex[(*iter).encoding.id] = (int) nextGeneration.size();
+            this->objectives.push_back(objectivesForEncoding((*iter).encoding));
             nextGeneration.push_back(*iter);
             if (nextGeneration.size() == this->generationSize) {
                 break;
@@ -142,6 +156,7 @@ void ParetoSelector::sort() {
         }
     }
     this->generation = nextGeneration;
+    recordLatency(sortPhase, metricsClock() - start);
 }
 
 int ParetoSelector::selectionIndex() {
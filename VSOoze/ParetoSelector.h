@@ -4,6 +4,7 @@
 #include <map>
 
 #include "OozebotEncoding.h"
+#include "ObjectiveSet.h"
 #include "ParetoFront.h"
 
 const int NUM_THREADS = 50;
@@ -33,16 +34,27 @@ public:
 
     void insertOozebot(OozebotEncoding &encoding);
 
+    // Same result as inserting them one at a time in order
+    void insertOozebots(std::vector<OozebotEncoding> &encodings);
+
     // returns number of evaluations
     int selectAndMate(double duration);
 
     std::vector<OozebotSortWrapper> generation;
+    ObjectiveSet objectives; // same order as generation
     std::vector<double> indexToProbability;
     std::map<signed long int, int> idToIndex;
 
     void sort();
     void removeAllOozebots();
     int selectionIndex();
+
+private:
+    std::vector<unsigned char> candidateCovers;
+    std::vector<unsigned char> memberCovers;
+
+    // Records dominance between generation[index] and every member before it
+    void linkDominance(int index);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,157 @@
+#include "Pipeline.h"
+#include "Metrics.h"
+
+PipelineConfig pipelineConfig = kDefaultPipelineConfig;
+
+void configurePipeline(PipelineConfig config) {
+    pipelineConfig = config;
+}
+
+EvaluationPipeline::EvaluationPipeline(double duration, ParetoFront *archive, int capacity):
+    duration(duration),
+    archive(archive),
+    surrogate(archive != NULL ? archive->surrogate : NULL),
+    breedQueue(capacity > 0 ? capacity : pipelineConfig.queueCapacity),
+    buildQueue(capacity > 0 ? capacity : pipelineConfig.queueCapacity),
+    scoreQueue(capacity > 0 ? capacity : pipelineConfig.queueCapacity),
+    archiveQueue(capacity > 0 ? capacity : pipelineConfig.queueCapacity),
+    resultQueue(capacity > 0 ? capacity : pipelineConfig.queueCapacity) {
+    for (int i = 0; i < pipelineConfig.breedThreads; i++) {
+        this->threads.push_back(std::thread(&EvaluationPipeline::breed, this));
+    }
+    for (int i = 0; i < pipelineConfig.buildThreads; i++) {
+        this->threads.push_back(std::thread(&EvaluationPipeline::build, this));
+    }
+    for (int i = 0; i < pipelineConfig.scoreThreads; i++) {
+        this->threads.push_back(std::thread(&EvaluationPipeline::score, this));
+    }
+    for (int i = 0; i < pipelineConfig.archiveThreads; i++) {
+        this->threads.push_back(std::thread(&EvaluationPipeline::archiveResults, this));
+    }
+}
+
+EvaluationPipeline::~EvaluationPipeline() {
+    this->breedQueue.close();
+    this->buildQueue.close();
+    this->scoreQueue.close();
+    this->archiveQueue.close();
+    this->resultQueue.close();
+    for (auto it = this->threads.begin(); it != this->threads.end(); ++it) {
+        (*it).join();
+    }
+}
+
+void EvaluationPipeline::submit(std::function<OozebotEncoding()> makeChild, int tag, bool screen) {
+    PipelineItem item;
+    item.makeChild = makeChild;
+    item.tag = tag;
+    item.screen = screen;
+    addToGauge(inFlightGauge, 1);
+    this->breedQueue.push(std::move(item));
+}
+
+OozebotEncoding EvaluationPipeline::next(int *tag) {
+    PipelineItem item;
+    this->resultQueue.pop(item);
+    addToGauge(inFlightGauge, -1);
+    if (tag != NULL) {
+        *tag = item.tag;
+    }
+    return item.encoding;
+}
+
+int EvaluationPipeline::outstandingLimit() {
+    return this->breedQueue.capacity();
+}
+
+void EvaluationPipeline::breed() {
+    PipelineItem item;
+    while (this->breedQueue.pop(item)) {
+        ScreenedChild screened = screenChild(item.makeChild, item.screen ? this->surrogate : NULL);
+        item.makeChild = NULL; // whatever it captured can go now
+        item.encoding = std::move(screened.child);
+        item.verdict = screened.verdict;
+        item.built = this->surrogate != NULL;
+        if (item.built) {
+            // Unscreened children still train the surrogate so they need features too
+            item.inputs = item.screen ? std::move(screened.inputs) : OozebotEncoding::inputsFromEncoding(item.encoding);
+            item.features = item.screen ? screened.features : surrogateFeaturesForInputs(item.encoding, item.inputs);
+        }
+        if (!this->buildQueue.push(std::move(item))) {
+            return;
+        }
+    }
+}
+
+void EvaluationPipeline::build() {
+    PipelineItem item;
+    while (this->buildQueue.pop(item)) {
+        if (item.built) {
+            item.pending = submitBuiltEvaluation(std::move(item.encoding), item.inputs, this->duration);
+        } else {
+            item.pending = submitEvaluation(std::move(item.encoding), this->duration);
+        }
+        if (!this->scoreQueue.push(std::move(item))) {
+            return;
+        }
+    }
+}
+
+void EvaluationPipeline::score() {
+    // Robots are run costliest first, so they finish out of order. Holding them here rather than in the queue lets
+    // cheap ones through as soon as they're done and keeps the build stage handing out more
+    std::vector<PipelineItem> waiting;
+    PipelineItem item;
+    int spins = 0;
+    while (true) {
+        while (this->scoreQueue.tryPop(item)) {
+            waiting.push_back(std::move(item));
+        }
+        if (waiting.empty()) {
+            if (!this->scoreQueue.pop(item)) {
+                return;
+            }
+            waiting.push_back(std::move(item));
+        }
+        bool finishedAny = false;
+        for (int i = 0; i < (int) waiting.size(); i++) {
+            if (!evaluationReady(waiting[i].pending)) {
+                continue;
+            }
+            item = std::move(waiting[i]);
+            if (i != (int) waiting.size() - 1) {
+                waiting[i] = std::move(waiting.back());
+            }
+            waiting.pop_back();
+            i--;
+            finishEvaluation(item.pending);
+            item.encoding = std::move(item.pending.encoding);
+            if (this->surrogate != NULL) {
+                this->surrogate->record(item.features, item.encoding, item.verdict);
+            }
+            if (!this->archiveQueue.push(std::move(item))) {
+                return;
+            }
+            finishedAny = true;
+        }
+        if (finishedAny) {
+            spins = 0;
+        } else {
+            pipelineBackoff(spins);
+        }
+    }
+}
+
+void EvaluationPipeline::archiveResults() {
+    PipelineItem item;
+    while (this->archiveQueue.pop(item)) {
+        if (this->archive != NULL) {
+            this->archive->evaluateEncoding(item.encoding);
+        } else {
+            item.encoding.recording = NULL;
+        }
+        if (!this->resultQueue.push(std::move(item))) {
+            return;
+        }
+    }
+}
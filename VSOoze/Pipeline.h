@@ -0,0 +1,202 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "OozebotEncoding.h"
+#include "ParetoFront.h"
+#include "Surrogate.h"
+
+// Spins briefly, then yields, then sleeps - stages waiting on an empty or full queue shouldn't steal a simulating core
+inline void pipelineBackoff(int &spins) {
+    spins++;
+    if (spins < 64) {
+        return;
+    } else if (spins < 128) {
+        std::this_thread::yield();
+    } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+// Multi producer multi consumer ring (Vyukov's) - every cell carries a sequence number saying whose turn it is, so
+// pushes and pops only ever contend on one atomic each
+template <typename T>
+class BoundedQueue {
+public:
+    // Rounded up to a power of two
+    BoundedQueue(int capacity) {
+        size_t size = 2;
+        while (size < (size_t) capacity) {
+            size *= 2;
+        }
+        this->cells.reset(new Cell[size]);
+        this->mask = size - 1;
+        for (size_t i = 0; i < size; i++) {
+            this->cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        this->enqueuePosition.store(0, std::memory_order_relaxed);
+        this->dequeuePosition.store(0, std::memory_order_relaxed);
+        this->closed.store(false, std::memory_order_relaxed);
+    }
+
+    int capacity() {
+        return (int) (this->mask + 1);
+    }
+
+    // Moves out of item only if there was room
+    bool tryPush(T &item) {
+        size_t position = this->enqueuePosition.load(std::memory_order_relaxed);
+        while (true) {
+            Cell &cell = this->cells[position & this->mask];
+            const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            const long long difference = (long long) sequence - (long long) position;
+            if (difference == 0) {
+                if (this->enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    cell.value = std::move(item);
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (difference < 0) {
+                return false; // full
+            } else {
+                position = this->enqueuePosition.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool tryPop(T &item) {
+        size_t position = this->dequeuePosition.load(std::memory_order_relaxed);
+        while (true) {
+            Cell &cell = this->cells[position & this->mask];
+            const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            const long long difference = (long long) sequence - (long long) (position + 1);
+            if (difference == 0) {
+                if (this->dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    item = std::move(cell.value);
+                    cell.sequence.store(position + this->mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (difference < 0) {
+                return false; // empty
+            } else {
+                position = this->dequeuePosition.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Waits for room - this is the backpressure. False if the queue was closed first
+    bool push(T item) {
+        int spins = 0;
+        while (!this->closed.load(std::memory_order_acquire)) {
+            if (this->tryPush(item)) {
+                return true;
+            }
+            pipelineBackoff(spins);
+        }
+        return false;
+    }
+
+    // Waits for an item - false once the queue is closed and drained
+    bool pop(T &item) {
+        int spins = 0;
+        while (true) {
+            if (this->tryPop(item)) {
+                return true;
+            }
+            if (this->closed.load(std::memory_order_acquire)) {
+                return this->tryPop(item);
+            }
+            pipelineBackoff(spins);
+        }
+    }
+
+    // Wakes everything waiting on the queue - nothing more can be pushed
+    void close() {
+        this->closed.store(true, std::memory_order_release);
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+    alignas(64) std::atomic<size_t> enqueuePosition;
+    alignas(64) std::atomic<size_t> dequeuePosition;
+    std::atomic<bool> closed;
+};
+
+// Threads per stage. Simulation runs on simBackend()'s workers so its parallelism is the backend's
+struct PipelineConfig {
+    int breedThreads; // makeChild plus surrogate screening
+    int buildThreads; // inputsFromEncoding and handing the robot to the backend
+    int scoreThreads; // polling the backend, fitness reduction and surrogate training - in the order robots finish
+    int archiveThreads; // inserting into the ParetoFront
+    int queueCapacity; // per queue - also the most children a caller should have outstanding, unless the pipeline is given its own
+};
+
+const PipelineConfig kDefaultPipelineConfig = {2, 2, 2, 2, 64};
+
+// Call before any pipeline is running
+void configurePipeline(PipelineConfig config);
+
+struct PipelineItem {
+    std::function<OozebotEncoding()> makeChild;
+    int tag;
+    bool screen;
+    OozebotEncoding encoding;
+    SurrogateFeatures features;
+    SurrogateVerdict verdict;
+    SimInputs inputs; // built in breed for the features when there's a surrogate - the build stage reuses it
+    bool built;
+    PendingEvaluation pending;
+};
+
+// breed -> build phenotype -> simulate -> score -> archive, each stage on its own threads and joined by bounded
+// queues. Archiving into the ParetoFront happens on the pipeline's own threads so the caller only ever picks up
+// finished children. Keep at most outstandingLimit() children submitted but not collected or the stages can stall
+// on full queues
+class EvaluationPipeline {
+public:
+    // capacity overrides the configured queueCapacity - a whole generation's worth lets every child reach the
+    // backend before the first is collected, so costliest first orders the generation rather than a window of it
+    EvaluationPipeline(double duration, ParetoFront *archive, int capacity = 0);
+
+    // Abandons anything still in flight
+    ~EvaluationPipeline();
+
+    // Blocks while the breed queue is full. tag comes back with the child. Unscreened children skip the
+    // surrogate's verdict but it still trains on them
+    void submit(std::function<OozebotEncoding()> makeChild, int tag = 0, bool screen = true);
+
+    // The next child to be evaluated and archived, in completion order. Blocks
+    OozebotEncoding next(int *tag = NULL);
+
+    int outstandingLimit();
+
+private:
+    const double duration;
+    ParetoFront *archive;
+    Surrogate *surrogate;
+    BoundedQueue<PipelineItem> breedQueue;
+    BoundedQueue<PipelineItem> buildQueue;
+    BoundedQueue<PipelineItem> scoreQueue;
+    BoundedQueue<PipelineItem> archiveQueue;
+    BoundedQueue<PipelineItem> resultQueue;
+    std::vector<std::thread> threads;
+
+    void breed();
+    void build();
+    void score();
+    void archiveResults();
+};
+
+#endif
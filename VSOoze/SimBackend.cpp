@@ -0,0 +1,351 @@
+#define _USE_MATH_DEFINES
+#include <cmath>
+
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+
+#include "SimBackend.h"
+#include "Arena.h"
+#include "Metrics.h"
+#include "Trace.h"
+
+SimJob::~SimJob() {
+    releaseBuffer(this->request.points);
+    releaseBuffer(this->request.springs);
+    releaseBuffer(this->request.presets);
+    releaseBuffer(this->result.startPoints);
+    releaseBuffer(this->result.endPoints);
+}
+
+bool pollSim(SimTicket &ticket) {
+    return ticket->done.load(std::memory_order_acquire);
+}
+
+SimResult &waitForSim(SimTicket &ticket) {
+    if (!pollSim(ticket)) {
+        std::unique_lock<std::mutex> lock(ticket->mutex);
+        ticket->finished.wait(lock, [&]() { return pollSim(ticket); });
+    }
+    return ticket->result;
+}
+
+double stretchedDuration(double duration, double oscillationFrequency) {
+    int numCycles = 1;
+    double oscillationDuration = 2 * M_PI / oscillationFrequency;
+    while ((oscillationDuration * numCycles + 1.0) < duration) {
+        numCycles += 1;
+    }
+    return (oscillationDuration * numCycles) + 1.0;
+}
+
+double predictedSpringSteps(size_t numSprings, double duration, double oscillationFrequency, float dt) {
+    return (double) numSprings * (stretchedDuration(duration, oscillationFrequency) / dt);
+}
+
+SimBackend::SimBackend(SimBackendKind kind, int numWorkers, std::vector<NumaNode> nodes):
+    kind(kind),
+    numWorkers(std::max(1, numWorkers)),
+    nodes(nodes),
+    wake(std::max((size_t) 1, nodes.size())),
+    queues(std::max((size_t) 1, nodes.size())),
+    outstandingCost(std::max((size_t) 1, nodes.size()), 0) {}
+
+SimTicket SimBackend::submit(SimRequest request) {
+    SimTicket ticket = std::make_shared<SimJob>();
+    ticket->request = std::move(request);
+    ticket->done.store(false, std::memory_order_relaxed);
+    SimRequest &submitted = ticket->request;
+    const size_t numSprings = submitted.lattice != NULL ? latticeSpringCount(*submitted.lattice) : submitted.springs.size();
+    submitted.cost = predictedSpringSteps(numSprings, submitted.duration, submitted.oscillationFrequency, submitted.options.dt);
+    ticket->overtaken = 0;
+    ticket->submittedAt = metricsClock();
+    int queue;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        // Workers call run so they can't start until the subclass is fully constructed
+        if (this->workers.empty()) {
+            for (int i = 0; i < this->numWorkers; i++) {
+                this->workers.push_back(std::thread(&SimBackend::work, this, i % (int) this->queues.size()));
+            }
+        }
+        const int numQueues = (int) this->queues.size();
+        // Least predicted work outstanding
+        queue = this->nextQueue++ % numQueues;
+        for (int i = 1; i < numQueues; i++) {
+            const int other = (queue + i) % numQueues;
+            if (this->outstandingCost[other] < this->outstandingCost[queue]) {
+                queue = other;
+            }
+        }
+        ticket->queue = queue;
+        this->outstandingCost[queue] += submitted.cost;
+        // Costliest first, but never ahead of a robot that has already been overtaken too often
+        std::deque<SimTicket> &waiting = this->queues[queue];
+        auto position = waiting.end();
+        while (position != waiting.begin()) {
+            SimJob &ahead = **(position - 1);
+            if (ahead.request.cost >= submitted.cost || ahead.overtaken >= kSimMaxOvertakes) {
+                break;
+            }
+            --position;
+        }
+        for (auto it = position; it != waiting.end(); ++it) {
+            (*it)->overtaken++;
+        }
+        waiting.insert(position, ticket);
+        addToGauge(simQueuedGauge, 1);
+    }
+    this->wake[queue].notify_one();
+    return ticket;
+}
+
+int SimBackend::queued() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    int total = 0;
+    for (auto it = this->queues.begin(); it != this->queues.end(); ++it) {
+        total += (int) (*it).size();
+    }
+    return total;
+}
+
+int SimBackend::idleWorkers() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    int busy = this->numRunning;
+    for (auto it = this->queues.begin(); it != this->queues.end(); ++it) {
+        busy += (int) (*it).size();
+    }
+    return std::max(0, this->numWorkers - busy);
+}
+
+SimCostStats SimBackend::costStats() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->stats;
+}
+
+void SimBackend::printCostStats() {
+    SimCostStats s = this->costStats();
+    double predicted = s.robots > 1 ? s.robots - 1 : 1; // the first robot had no fit to predict it with
+    double actualSeconds = s.actualSeconds > 0 ? s.actualSeconds : 1;
+    printf("Sim cost: %ld robots, %.3f ns per spring step, predicted %.1fs vs actual %.1fs, mean error %.3fs (%.1f%%)\n",
+        s.robots, s.secondsPerSpringStep * 1e9, s.predictedSeconds, s.actualSeconds, s.absError / predicted,
+        100.0 * s.absError / actualSeconds);
+}
+
+bool SimBackend::allQueuesEmpty() {
+    for (auto it = this->queues.begin(); it != this->queues.end(); ++it) {
+        if (!(*it).empty()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void SimBackend::stop() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    for (auto it = this->wake.begin(); it != this->wake.end(); ++it) {
+        (*it).notify_all();
+    }
+    for (auto it = this->workers.begin(); it != this->workers.end(); ++it) {
+        (*it).join();
+    }
+    this->workers.clear();
+}
+
+void SimBackend::work(int queue) {
+    if (!this->nodes.empty() && !pinThreadToCpus(this->nodes[queue].cpus)) {
+        printf("Couldn't pin a sim worker to node %d\n", this->nodes[queue].id);
+    }
+    while (true) {
+        SimTicket ticket;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            bool idle = false;
+            while (ticket == NULL) {
+                if (!this->queues[queue].empty()) {
+                    ticket = this->queues[queue].front();
+                    this->queues[queue].pop_front();
+                    addToGauge(simQueuedGauge, -1);
+                } else if (idle) {
+                    for (int i = 1; i < this->queues.size() && ticket == NULL; i++) {
+                        std::deque<SimTicket> &other = this->queues[(queue + i) % this->queues.size()];
+                        if (!other.empty()) {
+                            ticket = other.front();
+                            other.pop_front();
+                            addToGauge(simQueuedGauge, -1);
+                            countMetric(simStealsCounter, 1);
+                            // It's this node's load now
+                            this->outstandingCost[ticket->queue] -= ticket->request.cost;
+                            this->outstandingCost[queue] += ticket->request.cost;
+                            ticket->queue = queue;
+                        }
+                    }
+                }
+                if (ticket == NULL) {
+                    if (this->stopping && this->allQueuesEmpty()) {
+                        return; // stopping and drained
+                    }
+                    if (this->queues.size() == 1) {
+                        this->wake[queue].wait(lock);
+                    } else {
+                        idle = this->wake[queue].wait_for(lock, std::chrono::microseconds(kSimStealDelayMicroseconds)) == std::cv_status::timeout;
+                    }
+                }
+            }
+            this->numRunning++;
+        }
+        addToGauge(activeWorkersGauge, 1);
+        const double cost = ticket->request.cost;
+        const double start = metricsClock();
+        recordLatency(queuePhase, start - ticket->submittedAt);
+        this->run(ticket->request, ticket->result);
+        const double seconds = metricsClock() - start;
+        ticket->result.simulateSeconds = seconds;
+        addToGauge(activeWorkersGauge, -1);
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->outstandingCost[ticket->queue] -= cost;
+            this->numRunning--;
+            if (this->stats.robots > 0) {
+                const double predicted = this->stats.secondsPerSpringStep * cost;
+                this->stats.predictedSeconds += predicted;
+                this->stats.actualSeconds += seconds;
+                this->stats.absError += std::abs(predicted - seconds);
+            }
+            this->stats.robots++;
+            this->sumCostSquared += cost * cost;
+            this->sumCostTimesSeconds += cost * seconds;
+            if (this->sumCostSquared > 0) {
+                this->stats.secondsPerSpringStep = this->sumCostTimesSeconds / this->sumCostSquared;
+            }
+        }
+        {
+            // Under the lock so a waiter can't check done and then miss the notify
+            std::lock_guard<std::mutex> lock(ticket->mutex);
+            ticket->done.store(true, std::memory_order_release);
+        }
+        ticket->finished.notify_all();
+    }
+}
+
+// The lattice engine has no observer and no GPU port
+void runLattice(SimRequest &request, SimResult &result) {
+    LatticeRobot &robot = *request.lattice;
+    const float frequency = (float) request.oscillationFrequency;
+    result.duration = stretchedDuration(request.duration, request.oscillationFrequency);
+    double phaseStart = metricsClock();
+    result.valid = simulateLattice(robot, request.presets, 1.0, 0, frequency, request.options);
+    traceSpanEvent("settle", phaseStart, metricsClock());
+    if (!result.valid) {
+        return;
+    }
+    result.startPoints = acquireBuffer<Point>();
+    latticeToPoints(robot, result.startPoints);
+    phaseStart = metricsClock();
+    result.valid = simulateLattice(robot, request.presets, result.duration - 1.0, 0, frequency, request.options);
+    traceSpanEvent("simulate", phaseStart, metricsClock());
+    countMetric(springStepsCounter, (long long) request.cost);
+    result.endPoints = acquireBuffer<Point>();
+    latticeToPoints(robot, result.endPoints);
+    request.lattice = NULL; // frees the robot now rather than when the ticket goes
+}
+
+CPUSimBackend::CPUSimBackend(int numWorkers, std::vector<NumaNode> nodes):SimBackend(cpuBackend, numWorkers, nodes) {}
+
+CPUSimBackend::~CPUSimBackend() {
+    this->stop();
+}
+
+void CPUSimBackend::run(SimRequest &request, SimResult &result) {
+    if (request.lattice != NULL) {
+        runLattice(request, result);
+        return;
+    }
+    std::vector<Point> *points = &request.points;
+    if (!this->nodes.empty()) {
+        // The points were built on whichever thread submitted them and pooled buffers were last touched by anyone.
+        // Stepping a copy only this pinned worker ever touches keeps the pages the step loop hammers on its own node
+        // (first touch), as it already does for the compacted springs
+        thread_local std::vector<Point> local; // reused robot to robot
+        local.assign(request.points.begin(), request.points.end());
+        points = &local;
+    }
+    thread_local CompactSprings springs; // reused robot to robot
+    compactSprings(request.springs, springs);
+    const float frequency = (float) request.oscillationFrequency;
+    result.duration = stretchedDuration(request.duration, request.oscillationFrequency);
+    double phaseStart = metricsClock();
+    result.valid = simulateCompactCPP(*points, springs, request.presets, 1.0, 0, frequency, request.options, request.observer.get());
+    traceSpanEvent("settle", phaseStart, metricsClock());
+    if (!result.valid) {
+        return;
+    }
+    result.startPoints = acquireBuffer<Point>();
+    result.startPoints.assign(points->begin(), points->end());
+    phaseStart = metricsClock();
+    result.valid = simulateCompactCPP(*points, springs, request.presets, result.duration - 1.0, 0, frequency, request.options, request.observer.get());
+    traceSpanEvent("simulate", phaseStart, metricsClock());
+    countMetric(springStepsCounter, (long long) (request.springs.size() * (result.duration / request.options.dt)));
+    if (points != &request.points) {
+        request.points.assign(points->begin(), points->end());
+    }
+    result.endPoints = std::move(request.points);
+}
+
+CUDASimBackend::CUDASimBackend(int numWorkers):SimBackend(cudaBackend, numWorkers) {}
+
+CUDASimBackend::~CUDASimBackend() {
+    this->stop();
+}
+
+// The handle API is synchronous under the hood so each worker drives one robot on the device at a time
+void CUDASimBackend::run(SimRequest &request, SimResult &result) {
+    if (request.lattice != NULL) {
+        runLattice(request, result);
+        return;
+    }
+    const int numPoints = (int) request.points.size();
+    AsyncSimHandle handle = createSimHandle((int) request.id, numPoints, (int) request.springs.size());
+    double phaseStart = metricsClock();
+    simulate(handle, request.points, request.springs, request.presets, request.duration, request.oscillationFrequency, request.options);
+    traceSpanEvent("simulate", phaseStart, metricsClock());
+    result.duration = stretchedDuration(request.duration, request.oscillationFrequency);
+    result.valid = !isinf(handle.duration);
+    result.startPoints = acquireBuffer<Point>();
+    result.startPoints.assign(handle.startPoints, handle.startPoints + numPoints);
+    result.endPoints = std::move(request.points); // simulate copies the final state back into points
+    countMetric(springStepsCounter, (long long) (request.springs.size() * (request.duration / request.options.dt)));
+    releaseSimHandle(handle);
+}
+
+SimBackend *createSimBackend(SimBackendKind kind, int numWorkers, std::vector<NumaNode> nodes) {
+    if (kind == cudaBackend) {
+        return new CUDASimBackend(numWorkers);
+    }
+    return new CPUSimBackend(numWorkers, nodes);
+}
+
+std::atomic<SimBackend *> currentSimBackend(NULL);
+std::mutex simBackendMutex;
+
+SimBackend &simBackend() {
+    SimBackend *backend = currentSimBackend.load(std::memory_order_acquire);
+    if (backend == NULL) {
+        std::lock_guard<std::mutex> lock(simBackendMutex);
+        backend = currentSimBackend.load(std::memory_order_relaxed);
+        if (backend == NULL) {
+            // Never freed - workers may still be finishing when statics are torn down at exit
+            backend = createSimBackend(cpuBackend, std::max(1, (int) std::thread::hardware_concurrency()));
+            currentSimBackend.store(backend, std::memory_order_release);
+        }
+    }
+    return *backend;
+}
+
+void useSimBackend(SimBackend *backend) {
+    currentSimBackend.store(backend, std::memory_order_release);
+}
@@ -0,0 +1,164 @@
+#ifndef SIM_BACKEND_H
+#define SIM_BACKEND_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "cppSim.h"
+#include "latticeSim.h"
+#include "Numa.h"
+
+enum SimBackendKind {
+    cpuBackend, // thread pool running the cpu engine - the default
+    cudaBackend, // the createSimHandle/simulate API in cudaSim.cu, needs a GPU
+};
+
+// One robot to simulate. Every backend settles it for a second, notes where it ended up, then runs it for the
+// duration stretched to whole oscillations
+struct SimRequest {
+    unsigned long int id; // spreads cuda jobs over the devices
+    std::vector<Point> points;
+    std::vector<Spring> springs;
+    std::vector<FlexPreset> presets;
+    double duration; // seconds including the settle
+    double oscillationFrequency;
+    SimOptions options;
+    std::shared_ptr<SimObserver> observer; // NULL for none - only the cpu backend samples
+    double cost; // predictedSpringSteps - filled in by submit
+    // Set instead of points and springs for the lattice engine, which runs on the cpu whatever the backend
+    std::shared_ptr<LatticeRobot> lattice;
+};
+
+struct SimResult {
+    bool valid; // false if the robot tore itself apart
+    double duration; // stretched - what fitness is normalized by
+    std::vector<Point> startPoints; // once settled
+    std::vector<Point> endPoints;
+    double simulateSeconds; // wall time the worker spent in run - queueing isn't counted
+};
+
+struct SimJob {
+    SimRequest request;
+    SimResult result;
+    std::atomic<bool> done;
+    std::mutex mutex;
+    std::condition_variable finished;
+    double submittedAt; // metricsClock - the wait for a worker goes to the queue phase
+    int queue; // whose outstanding cost it counts towards
+    int overtaken; // by costlier robots submitted after it
+
+    // Hands the robot's buffers back to the pools
+    ~SimJob();
+};
+
+typedef std::shared_ptr<SimJob> SimTicket;
+
+// Never blocks - true once the result is ready
+bool pollSim(SimTicket &ticket);
+
+// Blocks until the result is ready
+SimResult &waitForSim(SimTicket &ticket);
+
+// duration stretched to end on the same phase of the oscillation it started on
+double stretchedDuration(double duration, double oscillationFrequency);
+
+// Simulation time is close to linear in springs times timesteps, settle included - that's the cost model
+double predictedSpringSteps(size_t numSprings, double duration, double oscillationFrequency, float dt);
+
+// How predicted cost lines up with how long robots actually took
+struct SimCostStats {
+    long robots;
+    double secondsPerSpringStep; // least squares fit through the origin
+    double predictedSeconds; // each robot predicted with the fit as it stood before it ran
+    double actualSeconds;
+    double absError; // summed over robots, in seconds
+};
+
+// How long an idle worker leaves another node's robots for that node's own workers before taking one
+const int kSimStealDelayMicroseconds = 1000;
+
+// Most times a queued robot can be overtaken by costlier ones, so a stream of big robots can't starve it
+const int kSimMaxOvertakes = 128;
+
+// Queue of submitted robots drained by a fixed set of worker threads, started on the first submit.
+// Given NUMA nodes, workers are spread evenly over them and pinned there, every node gets its own queue and a worker
+// only takes another node's robot once it has sat idle for kSimStealDelayMicroseconds.
+// Robots go to the queue with the least predicted work outstanding and are run costliest first, so the biggest
+// robots of a generation start early rather than keeping every other core waiting at its end
+class SimBackend {
+public:
+    const SimBackendKind kind;
+    const int numWorkers;
+    const std::vector<NumaNode> nodes; // empty for unpinned workers sharing one queue
+
+    SimBackend(SimBackendKind kind, int numWorkers, std::vector<NumaNode> nodes = {});
+    virtual ~SimBackend() {}
+
+    // Never blocks
+    SimTicket submit(SimRequest request);
+
+    // Submitted robots no worker has picked up yet
+    int queued();
+
+    // Workers with nothing queued for them - how many threads other work can take without oversubscribing the cores
+    int idleWorkers();
+
+    SimCostStats costStats();
+    void printCostStats();
+
+protected:
+    // Finishes the queue and joins the workers - every subclass destructor has to call this
+    void stop();
+
+    virtual void run(SimRequest &request, SimResult &result) = 0;
+
+private:
+    std::mutex mutex; // guards every queue - robots take far longer to simulate than to hand out
+    std::vector<std::condition_variable> wake; // one per queue
+    std::vector<std::deque<SimTicket>> queues;
+    std::vector<std::thread> workers;
+    std::vector<double> outstandingCost; // per queue, queued or running
+    int numRunning = 0;
+    unsigned int nextQueue = 0; // where ties start - spreads robots round robin while every queue is idle
+    SimCostStats stats = {};
+    double sumCostSquared = 0; // for the fit
+    double sumCostTimesSeconds = 0;
+    bool stopping = false;
+
+    void work(int queue);
+    bool allQueuesEmpty();
+};
+
+class CPUSimBackend : public SimBackend {
+public:
+    CPUSimBackend(int numWorkers, std::vector<NumaNode> nodes = {});
+    ~CPUSimBackend();
+
+protected:
+    void run(SimRequest &request, SimResult &result);
+};
+
+class CUDASimBackend : public SimBackend {
+public:
+    CUDASimBackend(int numWorkers);
+    ~CUDASimBackend();
+
+protected:
+    void run(SimRequest &request, SimResult &result);
+};
+
+// Pass numaTopology() as nodes to place the workers
+SimBackend *createSimBackend(SimBackendKind kind, int numWorkers, std::vector<NumaNode> nodes = {});
+
+// Where evaluate sends its robots - a CPUSimBackend with a worker per core unless useSimBackend picked another
+SimBackend &simBackend();
+
+// Call before any simulation is running. The backend has to outlive every evaluation
+void useSimBackend(SimBackend *backend);
+
+#endif
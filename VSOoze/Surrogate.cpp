@@ -0,0 +1,214 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include "Surrogate.h"
+#include "Metrics.h"
+#include "Trace.h"
+
+SurrogateFeatures surrogateFeaturesForInputs(OozebotEncoding &encoding, SimInputs &inputs) {
+    double mass = 0;
+    double us = 0;
+    double uk = 0;
+    for (auto it = inputs.points.begin(); it != inputs.points.end(); ++it) {
+        mass += (*it).mass;
+        us += (*it).us;
+        uk += (*it).uk;
+    }
+    double k = 0;
+    double amplitude = 0;
+    double actuated = 0;
+    for (auto it = inputs.springs.begin(); it != inputs.springs.end(); ++it) {
+        const FlexPreset &preset = inputs.springPresets[(*it).flexIndex];
+        k += (*it).k;
+        amplitude += fabs(preset.b);
+        actuated += preset.b != 0 ? 1 : 0;
+    }
+    const double numPoints = inputs.points.size() > 0 ? inputs.points.size() : 1;
+    const double numSprings = inputs.springs.size() > 0 ? inputs.springs.size() : 1;
+    // Counts are logged so one huge robot doesn't swamp the distance
+    SurrogateFeatures features = {{
+        (float) log(1.0 + inputs.points.size()),
+        (float) log(1.0 + inputs.springs.size()),
+        (float) inputs.length,
+        (float) encoding.globalTimeInterval,
+        (float) (mass / numPoints),
+        (float) (us / numPoints),
+        (float) (uk / numPoints),
+        (float) log(1.0 + k / numSprings),
+        (float) (amplitude / numSprings),
+        (float) (actuated / numSprings),
+    }};
+    return features;
+}
+
+Surrogate::Surrogate(SurrogateConfig config):config(config), rng(rand()) {
+    this->features.reserve(config.maxSamples);
+    this->objectives.reserve(config.maxSamples);
+}
+
+// Inverse distance weighted average of the k nearest samples in standardized feature space
+Objectives Surrogate::predict(const SurrogateFeatures &query) {
+    float scale[kNumSurrogateFeatures];
+    for (int f = 0; f < kNumSurrogateFeatures; f++) {
+        double variance = this->featureM2[f] / this->numRecorded;
+        scale[f] = variance > 1e-12 ? (float) (1.0 / variance) : 0.0f; // a feature that never changes says nothing
+    }
+
+    const int k = std::min(this->config.neighbours, (int) this->features.size());
+    std::vector<std::pair<float, int>> nearest; // sorted by distance, at most k long
+    nearest.reserve(k + 1);
+    for (int i = 0; i < this->features.size(); i++) {
+        float distance = 0;
+        for (int f = 0; f < kNumSurrogateFeatures; f++) {
+            float delta = query.values[f] - this->features[i].values[f];
+            distance += delta * delta * scale[f];
+        }
+        if (nearest.size() == k && distance >= nearest.back().first) {
+            continue;
+        }
+        auto position = nearest.end();
+        while (position != nearest.begin() && (*(position - 1)).first > distance) {
+            --position;
+        }
+        nearest.insert(position, {distance, i});
+        if (nearest.size() > k) {
+            nearest.pop_back();
+        }
+    }
+
+    Objectives prediction = {};
+    double totalWeight = 0;
+    for (auto it = nearest.begin(); it != nearest.end(); ++it) {
+        double weight = 1.0 / (sqrt((*it).first) + 1e-6);
+        for (int m = 0; m < kNumObjectives; m++) {
+            prediction.values[m] += weight * this->objectives[(*it).second].values[m];
+        }
+        totalWeight += weight;
+    }
+    for (int m = 0; m < kNumObjectives; m++) {
+        prediction.values[m] /= totalWeight;
+    }
+    return prediction;
+}
+
+// True if some simulated robot beats the candidate by rejectMargin standard deviations in every objective
+bool Surrogate::farBehindFront(const Objectives &candidate) {
+    Objectives threshold;
+    for (int m = 0; m < kNumObjectives; m++) {
+        threshold.values[m] = candidate.values[m] + this->config.rejectMargin * sqrt(this->objectiveM2[m] / this->numRecorded);
+    }
+    for (auto it = this->objectives.begin(); it != this->objectives.end(); ++it) {
+        bool covers = true;
+        for (int m = 0; m < kNumObjectives; m++) {
+            covers &= (*it).values[m] >= threshold.values[m];
+        }
+        if (covers) {
+            return true;
+        }
+    }
+    return false;
+}
+
+SurrogateVerdict Surrogate::screen(const SurrogateFeatures &features) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    SurrogateVerdict verdict = {{}, false, false, true};
+    if (this->numRecorded < this->config.minSamples) {
+        return verdict;
+    }
+    verdict.hasPrediction = true;
+    verdict.predicted = this->predict(features);
+    this->counters.screened += 1;
+    if (this->farBehindFront(verdict.predicted)) {
+        verdict.rejected = true;
+        this->counters.rejected += 1;
+        verdict.simulate = std::uniform_real_distribution<double>(0, 1)(this->rng) < this->config.explorationFraction;
+        if (verdict.simulate) {
+            this->counters.explored += 1;
+        }
+    }
+    return verdict;
+}
+
+void Surrogate::record(const SurrogateFeatures &features, const OozebotEncoding &evaluated, const SurrogateVerdict &verdict) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    Objectives actual = objectivesForEncoding(evaluated);
+    if (verdict.hasPrediction) {
+        this->counters.scored += 1;
+        this->counters.fitnessAbsError += fabs(verdict.predicted.values[0] - actual.values[0]);
+        this->counters.lengthAdjAbsError += fabs(verdict.predicted.values[1] - actual.values[1]);
+        if (verdict.rejected) {
+            this->counters.simulatedRejections += 1;
+            if (!this->farBehindFront(actual)) {
+                this->counters.falseRejections += 1;
+            }
+        }
+    }
+
+    this->numRecorded += 1;
+    for (int f = 0; f < kNumSurrogateFeatures; f++) {
+        double delta = features.values[f] - this->featureMean[f];
+        this->featureMean[f] += delta / this->numRecorded;
+        this->featureM2[f] += delta * (features.values[f] - this->featureMean[f]);
+    }
+    for (int m = 0; m < kNumObjectives; m++) {
+        double delta = actual.values[m] - this->objectiveMean[m];
+        this->objectiveMean[m] += delta / this->numRecorded;
+        this->objectiveM2[m] += delta * (actual.values[m] - this->objectiveMean[m]);
+    }
+
+    if (this->features.size() < this->config.maxSamples) {
+        this->features.push_back(features);
+        this->objectives.push_back(actual);
+    } else {
+        this->features[this->nextSample] = features;
+        this->objectives[this->nextSample] = actual;
+        this->nextSample = (this->nextSample + 1) % this->config.maxSamples;
+    }
+}
+
+void Surrogate::discard() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->counters.simulationsSaved += 1;
+}
+
+SurrogateStats Surrogate::stats() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->counters;
+}
+
+void Surrogate::printStats() {
+    SurrogateStats s = this->stats();
+    double scored = s.scored > 0 ? s.scored : 1;
+    double simulatedRejections = s.simulatedRejections > 0 ? s.simulatedRejections : 1;
+    printf("Surrogate: screened %ld, rejected %ld (%ld explored), simulations saved %ld, fitness MAE %f, lengthAdj MAE %f, false rejections %ld/%ld (%.1f%%)\n",
+        s.screened, s.rejected, s.explored, s.simulationsSaved, s.fitnessAbsError / scored, s.lengthAdjAbsError / scored,
+        s.falseRejections, s.simulatedRejections, 100.0 * s.falseRejections / simulatedRejections);
+}
+
+ScreenedChild screenChild(std::function<OozebotEncoding()> makeChild, Surrogate *surrogate) {
+    double start = metricsClock();
+    ScreenedChild screened = {makeChild(), {}, {}, {{}, false, false, true}};
+    recordLatency(generatePhase, metricsClock() - start);
+    traceSpanEvent("generate", start, metricsClock());
+    if (surrogate == NULL) {
+        return screened;
+    }
+
+    screened.inputs = OozebotEncoding::inputsFromEncoding(screened.child);
+    screened.features = surrogateFeaturesForInputs(screened.child, screened.inputs);
+    screened.verdict = surrogate->screen(screened.features);
+    for (int attempt = 1; !screened.verdict.simulate && attempt < surrogate->config.maxAttempts; attempt++) {
+        surrogate->discard();
+        releaseSimInputs(screened.inputs);
+        start = metricsClock();
+        screened.child = makeChild();
+        recordLatency(generatePhase, metricsClock() - start);
+        traceSpanEvent("generate", start, metricsClock());
+        screened.inputs = OozebotEncoding::inputsFromEncoding(screened.child);
+        screened.features = surrogateFeaturesForInputs(screened.child, screened.inputs);
+        screened.verdict = surrogate->screen(screened.features);
+    }
+    // Out of attempts - the last child gets simulated whatever was predicted
+    return screened;
+}
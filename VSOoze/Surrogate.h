@@ -0,0 +1,99 @@
+#ifndef SURROGATE_H
+#define SURROGATE_H
+
+#include <functional>
+#include <mutex>
+#include <random>
+#include <vector>
+
+#include "OozebotEncoding.h"
+#include "ObjectiveSet.h"
+
+const int kNumSurrogateFeatures = 10;
+
+struct SurrogateFeatures {
+    float values[kNumSurrogateFeatures];
+};
+
+// Cheap description of the robot an encoding builds - point and spring counts, material mix, actuation and
+// globalTimeInterval. Read off the SimInputs inputsFromEncoding made for it, without simulating
+SurrogateFeatures surrogateFeaturesForInputs(OozebotEncoding &encoding, SimInputs &inputs);
+
+struct SurrogateConfig {
+    int neighbours; // k for the k-NN prediction
+    int minSamples; // nothing is screened until this many robots have been simulated
+    int maxSamples; // past this the oldest samples get overwritten
+    double explorationFraction; // share of rejected children that get simulated anyway
+    double rejectMargin; // standard deviations a known robot has to beat the prediction by in every objective
+    int maxAttempts; // children tried for one slot before the last one is simulated regardless
+};
+
+const SurrogateConfig kDefaultSurrogateConfig = {8, 200, 4000, 0.1, 0.5, 4};
+
+struct SurrogateVerdict {
+    Objectives predicted;
+    bool hasPrediction; // false while warming up
+    bool rejected; // predicted to be far behind the front
+    bool simulate; // rejected children are still simulated if picked for exploration
+};
+
+struct SurrogateStats {
+    long screened;
+    long rejected;
+    long explored; // rejected but picked to be simulated anyway
+    long simulationsSaved; // rejected children thrown away without simulating
+    long scored; // simulated children that had a prediction
+    double fitnessAbsError; // summed over scored
+    double lengthAdjAbsError;
+    long simulatedRejections; // explored plus the ones simulated because maxAttempts ran out
+    long falseRejections; // simulated rejections that turned out not to be far behind the front
+};
+
+// Online k-NN regressor over SurrogateFeatures predicting fitness and lengthAdj. Every method is thread safe
+class Surrogate {
+public:
+    const SurrogateConfig config;
+
+    Surrogate(SurrogateConfig config);
+
+    SurrogateVerdict screen(const SurrogateFeatures &features);
+
+    // A rejected child was thrown away without simulating
+    void discard();
+
+    // Adds a simulated robot to the training set and scores the verdict it was screened with
+    void record(const SurrogateFeatures &features, const OozebotEncoding &evaluated, const SurrogateVerdict &verdict);
+
+    SurrogateStats stats();
+    void printStats();
+
+private:
+    std::mutex mutex;
+    std::mt19937 rng;
+    std::vector<SurrogateFeatures> features;
+    std::vector<Objectives> objectives;
+    int nextSample = 0; // ring buffer position once maxSamples is reached
+    long numRecorded = 0;
+    // Running mean and sum of squared deviations (Welford) - features are standardized with these
+    double featureMean[kNumSurrogateFeatures] = {};
+    double featureM2[kNumSurrogateFeatures] = {};
+    double objectiveMean[kNumObjectives] = {};
+    double objectiveM2[kNumObjectives] = {};
+    SurrogateStats counters = {};
+
+    Objectives predict(const SurrogateFeatures &query);
+    bool farBehindFront(const Objectives &candidate);
+};
+
+struct ScreenedChild {
+    OozebotEncoding child;
+    SurrogateFeatures features; // only filled in when there's a surrogate
+    SimInputs inputs; // the phenotype the features came from, ready to simulate - empty with no surrogate
+    SurrogateVerdict verdict;
+};
+
+// Makes children until the surrogate lets one through (or maxAttempts runs out), without simulating any. With no
+// surrogate this is just makeChild. The caller simulates the child and trains the surrogate on it with record
+ScreenedChild screenChild(std::function<OozebotEncoding()> makeChild, Surrogate *surrogate);
+
+#endif
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+#include "Metrics.h"
+#include "Trace.h"
+
+struct TraceEvent {
+    const char *name;
+    double start; // seconds on metricsClock
+    double duration; // negative for instant events
+};
+
+struct TraceLane {
+    int id;
+    std::vector<TraceEvent> events; // ring of kTraceEventsPerLane
+    unsigned long long head; // events ever recorded - the next one goes at head % size
+    std::mutex mutex; // only ever contended while writeTrace copies the lane out
+};
+
+std::atomic<bool> tracingOn(false);
+double traceEpoch = 0;
+std::mutex laneMutex;
+std::vector<TraceLane *> allLanes;
+std::vector<TraceLane *> freeLanes;
+
+TraceLane *acquireLane() {
+    std::lock_guard<std::mutex> lock(laneMutex);
+    if (!freeLanes.empty()) {
+        TraceLane *lane = freeLanes.back();
+        freeLanes.pop_back();
+        return lane;
+    }
+    TraceLane *lane = new TraceLane();
+    lane->id = (int) allLanes.size() + 1;
+    lane->events.resize(kTraceEventsPerLane);
+    lane->head = 0;
+    allLanes.push_back(lane);
+    return lane;
+}
+
+// Hands the lane back when its thread exits - lanes are never freed so writeTrace can still read them
+struct TraceLaneOwner {
+    TraceLane *lane = NULL;
+
+    ~TraceLaneOwner() {
+        if (this->lane != NULL) {
+            std::lock_guard<std::mutex> lock(laneMutex);
+            freeLanes.push_back(this->lane);
+        }
+    }
+};
+
+thread_local TraceLaneOwner laneOwner;
+
+void recordTraceEvent(const char *name, double start, double duration) {
+    if (laneOwner.lane == NULL) {
+        laneOwner.lane = acquireLane();
+    }
+    TraceLane *lane = laneOwner.lane;
+    std::lock_guard<std::mutex> lock(lane->mutex);
+    lane->events[lane->head % lane->events.size()] = {name, start, duration};
+    lane->head++;
+}
+
+void enableTracing() {
+    traceEpoch = metricsClock();
+    tracingOn.store(true, std::memory_order_relaxed);
+}
+
+void traceSpanEvent(const char *name, double start, double end) {
+    if (tracingEnabled()) {
+        recordTraceEvent(name, start, end - start);
+    }
+}
+
+void traceInstant(const char *name) {
+    recordTraceEvent(name, metricsClock(), -1);
+}
+
+TraceSpan::TraceSpan(const char *name):name(name), start(tracingEnabled() ? metricsClock() : -1) {}
+
+TraceSpan::~TraceSpan() {
+    if (this->start >= 0 && tracingEnabled()) {
+        recordTraceEvent(this->name, this->start, metricsClock() - this->start);
+    }
+}
+
+bool writeTrace(const std::string &path) {
+    std::vector<TraceLane *> lanes;
+    {
+        std::lock_guard<std::mutex> lock(laneMutex);
+        lanes = allLanes;
+    }
+    std::ofstream file(path);
+    if (!file.is_open()) {
+        printf("Couldn't write trace to %s\n", path.c_str());
+        return false;
+    }
+    char line[512];
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    std::vector<TraceEvent> events;
+    for (auto it = lanes.begin(); it != lanes.end(); ++it) {
+        TraceLane *lane = *it;
+        {
+            // Copied out oldest first so the lane's thread is only held up for the copy, not the formatting
+            std::lock_guard<std::mutex> lock(lane->mutex);
+            const unsigned long long size = lane->events.size();
+            const unsigned long long oldest = lane->head > size ? lane->head - size : 0;
+            events.clear();
+            for (unsigned long long i = oldest; i < lane->head; i++) {
+                events.push_back(lane->events[i % size]);
+            }
+        }
+        snprintf(line, sizeof(line), "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"lane %d\"}}", first ? "" : ",\n", lane->id, lane->id);
+        file << line;
+        first = false;
+        for (auto event = events.begin(); event != events.end(); ++event) {
+            const double ts = ((*event).start - traceEpoch) * 1000000;
+            if ((*event).duration < 0) {
+                snprintf(line, sizeof(line), ",\n{\"name\": \"%s\", \"ph\": \"i\", \"s\": \"g\", \"ts\": %.3f, \"pid\": 1, \"tid\": %d}", (*event).name, ts, lane->id);
+            } else {
+                snprintf(line, sizeof(line), ",\n{\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %d}", (*event).name, ts, (*event).duration * 1000000, lane->id);
+            }
+            file << line;
+        }
+    }
+    file << "\n]}\n";
+    file.close();
+    return true;
+}
@@ -0,0 +1,46 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <string>
+
+// Opt-in timeline of what every thread is doing, written as Chrome trace-event JSON (chrome://tracing or
+// ui.perfetto.dev). Each thread records into its own ring buffer so only the last kTraceEventsPerLane events per
+// lane survive. Lanes are handed back when a thread exits and reused, so the short lived std::async workers show up
+// as a steady set of rows rather than one per evaluation
+
+const int kTraceEventsPerLane = 8192;
+
+extern std::atomic<bool> tracingOn;
+
+inline bool tracingEnabled() {
+    return tracingOn.load(std::memory_order_relaxed);
+}
+
+void enableTracing();
+
+// name must outlive the trace - string literals only
+void traceSpanEvent(const char *name, double start, double end);
+void traceInstant(const char *name);
+
+// Safe to call while tracing - each lane is copied out under its lock, so threads recording at the time are only
+// held up for the copy and anything they record after it is left out
+bool writeTrace(const std::string &path);
+
+// Records the enclosing scope as one span
+class TraceSpan {
+public:
+    TraceSpan(const char *name);
+    ~TraceSpan();
+
+private:
+    const char *name;
+    double start; // negative if tracing was off when the scope began
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SPAN(name) TraceSpan TRACE_CONCAT(traceSpan, __LINE__)(name)
+#define TRACE_INSTANT(name) do { if (tracingEnabled()) traceInstant(name); } while (0)
+
+#endif
@@ -4,30 +4,706 @@
 #include <math.h>
 #include <map>
 #include <chrono>
+#include <atomic>
+#include <thread>
 
-const float kGround = -100000.0;
-const float dt = 0.0001;
-const float dampening = 0.999;
-const float gravity = -9.81;
+const float kMaxTimestep = 0.001;
+const double kTimestepSafety = 0.5;
+const int kSmallRobotPoints = 2048; // 12 floats a point keeps a robot this size inside L2
+const int kRegisterMaterials = 4; // one per box - kernels specialized for at most this many keep them in locals
 
-bool simulateCPP(std::vector<Point>& points, std::vector<Spring>& springs, std::vector<FlexPreset> presets, double n, float oscillationFrequency) {
-    return simulateAgainCPP(points, springs, presets, n, 0, oscillationFrequency);
+IntraRobotThreading intraRobotThreading = {8192, 8, (int) std::thread::hardware_concurrency() / 2};
+std::atomic<int> availableHelperThreads(intraRobotThreading.helperBudget);
+
+void configureIntraRobotThreading(IntraRobotThreading config) {
+    intraRobotThreading = config;
+    availableHelperThreads = config.helperBudget;
+}
+
+// Takes as many helpers as the budget has left, up to wanted. Never blocks - a robot that gets none runs alone
+int acquireHelperThreads(int wanted) {
+    int available = availableHelperThreads.load();
+    while (available > 0) {
+        const int taken = std::min(available, wanted);
+        if (availableHelperThreads.compare_exchange_weak(available, available - taken)) {
+            return taken;
+        }
+    }
+    return 0;
+}
+
+void releaseHelperThreads(int count) {
+    availableHelperThreads += count;
+}
+
+// Reusable spin barrier - steps are short so sleeping on a condition variable would cost more than the wait.
+// Yields while spinning since the evaluation pool oversubscribes the cores
+class TeamBarrier {
+public:
+    TeamBarrier(int count) : count(count), waiting(0), generation(0) {}
+
+    void wait() {
+        const int gen = generation.load();
+        if (waiting.fetch_add(1) == count - 1) {
+            waiting = 0;
+            generation.fetch_add(1);
+            return;
+        }
+        while (generation.load() == gen) {
+            std::this_thread::yield();
+        }
+    }
+
+private:
+    const int count;
+    std::atomic<int> waiting;
+    std::atomic<int> generation;
+};
+
+bool simulateCPP(std::vector<Point>& points, std::vector<Spring>& springs, std::vector<FlexPreset>& presets, double n, float oscillationFrequency, SimOptions options) {
+    return simulateAgainCPP(points, springs, presets, n, 0, oscillationFrequency, options);
+}
+
+// Kernels instantiated for the default physics read it from here so the constants fold into the loop
+template <bool defaultPhysics>
+inline PhysicsParameters physicsFor(const PhysicsParameters &physics) {
+    return defaultPhysics ? kDefaultPhysics : physics;
+}
+
+double pointOmegaSquared(double springStiffness, float mass, ContactModel contact, const PhysicsParameters &physics) {
+    // By Gershgorin the fastest mode of a point is bounded by twice its summed spring stiffness over its mass.
+    // Penalty contact makes the ground one more (uncoupled) spring on whichever points touch it
+    const double groundStiffness = contact == penaltyContact ? -physics.groundStiffness : 0;
+    return (2 * springStiffness + groundStiffness) / mass;
+}
+
+float timestepForOmegaSquared(double maxOmegaSquared) {
+    if (maxOmegaSquared == 0) {
+        return kDefaultTimestep;
+    }
+    // Semi-implicit Euler is stable for omega * dt < 2 - stay well inside that since flexing and friction aren't linear
+    const double timestep = kTimestepSafety * 2.0 / sqrt(maxOmegaSquared);
+    return (float) std::min(std::max(timestep, (double) kDefaultTimestep), (double) kMaxTimestep);
+}
+
+float stableTimestep(std::vector<Point>& points, std::vector<Spring>& springs, ContactModel contact, PhysicsParameters physics) {
+    std::vector<double> stiffness(points.size(), 0.0);
+    for (auto it = springs.begin(); it != springs.end(); ++it) {
+        stiffness[(*it).p1] += (*it).k;
+        stiffness[(*it).p2] += (*it).k;
+    }
+    double maxOmegaSquared = 0;
+    for (int i = 0; i < points.size(); i++) {
+        maxOmegaSquared = std::max(maxOmegaSquared, pointOmegaSquared(stiffness[i], points[i].mass, contact, physics));
+    }
+    return timestepForOmegaSquared(maxOmegaSquared);
+}
+
+SimOptions simOptionsForRobot(std::vector<Point>& points, std::vector<Spring>& springs, SimIntegrator integrator, ContactModel contact, PhysicsParameters physics) {
+    if (integrator == eulerIntegrator) {
+        return {kDefaultTimestep, integrator, contact, physics};
+    }
+    return {stableTimestep(points, springs, contact, physics), integrator, contact, physics};
+}
+
+// Points that ended the step below the ground are projected back onto it. The velocity change that stops them
+// moving into the ground is the normal impulse (per unit mass), which bounds the Coulomb friction impulse
+void resolveGroundConstraints(std::vector<Point>& points, const int *contacts, int numContacts, float dt) {
+    for (int c = 0; c < numContacts; c++) {
+        Point &p = points[contacts[c]];
+        const float jn = p.vy < 0 ? -p.vy : 0;
+        p.y = 0;
+        p.vy += jn;
+
+        const float vh = sqrt(p.vx * p.vx + p.vz * p.vz);
+        // static friction holds the point in place, and kinetic friction can stop it but never push it back
+        const float scale = vh > p.us * jn ? std::max(0.0f, 1 - p.uk * jn / vh) : 0;
+        const float dvx = p.vx * (scale - 1);
+        const float dvz = p.vz * (scale - 1);
+        p.vx += dvx;
+        p.vz += dvz;
+        // undo the part of this step's drift that friction removed
+        p.x += dvx * dt;
+        p.z += dvz * dt;
+    }
+}
+
+// Penalty contact for a point at or below the ground - friction replaces the horizontal force in place and the
+// ground's push is returned for the integrator to add after gravity. fy is the spring force without gravity
+inline float penaltyGroundContact(float& fx, float fy, float& fz, float y, float mass, float us, float uk, const PhysicsParameters& physics) {
+    const float weight = fy + physics.gravity * mass;
+    const float fh = sqrt(fx * fx + fz * fz);
+    const float fykinetic = abs(weight * uk) / fh;
+    // static friction holds the point if the horizontal force doesn't overcome it
+    const bool holds = fh < abs(weight * us);
+    fx = holds ? 0 : fx - fx * fykinetic;
+    fz = holds ? 0 : fz - fz * fykinetic;
+    return physics.groundStiffness * y;
+}
+
+// Applies the accumulated forces, gravity and the ground's push to the point and clears the forces.
+// Contact is handled separately over the few grounded points so this has no branches
+inline void integratePoint(Point& p, float groundFy, float dt, float stepDampening, const PhysicsParameters& physics) {
+    const float mass = p.mass;
+    float fy = p.fy + physics.gravity * mass;
+    fy += groundFy;
+    const float ax = p.fx / mass;
+    const float ay = fy / mass;
+    const float az = p.fz / mass;
+    // reset the force cache
+    p.fx = 0;
+    p.fy = 0;
+    p.fz = 0;
+    const float vx = (ax * dt + p.vx) * stepDampening;
+    const float vy = (ay * dt + p.vy) * stepDampening;
+    const float vz = (az * dt + p.vz) * stepDampening;
+    p.vx = vx;
+    p.vy = vy;
+    p.vz = vz;
+    p.x += vx * dt;
+    p.y += vy * dt;
+    p.z += vz * dt;
+}
+
+// Writes the indices of the points in [start, end) touching the ground to contacts and returns how many there are.
+// Penalty contact pushes on points at the ground, constraints only on points under it
+inline int collectContacts(std::vector<Point>& points, int start, int end, bool penalty, int *contacts) {
+    int numContacts = 0;
+    for (int i = start; i < end; i++) {
+        contacts[numContacts] = i;
+        numContacts += penalty ? points[i].y <= 0 : points[i].y < 0;
+    }
+    return numContacts;
+}
+
+SimObserver createSimObserver(double interval, double duration, std::vector<int> trackedPoints, bool recordEnergy, bool recordContacts) {
+    SimObserver observer;
+    observer.interval = interval;
+    observer.untilNextSample = 0;
+    observer.recordEnergy = recordEnergy;
+    observer.recordContacts = recordContacts;
+    observer.trackedPoints = trackedPoints;
+    observer.capacity = (int) ceil(duration / interval) + 1;
+    observer.numSamples = 0;
+    return observer;
+}
+
+void recordSample(SimObserver &observer, std::vector<Point> &points, const PhysicsParameters &physics) {
+    if (observer.numSamples >= observer.capacity) {
+        return;
+    }
+    if (observer.numSamples == 0) {
+        // Reserved once the robot is actually running, not while it waits behind a generation's worth in the queue
+        observer.centerOfMass.reserve(3 * observer.capacity);
+        observer.trajectory.reserve(3 * observer.trackedPoints.size() * observer.capacity);
+        if (observer.recordEnergy) {
+            observer.kineticEnergy.reserve(observer.capacity);
+            observer.potentialEnergy.reserve(observer.capacity);
+        }
+        if (observer.recordContacts) {
+            observer.groundContacts.reserve(observer.capacity);
+        }
+    }
+    observer.numSamples += 1;
+    double mass = 0;
+    double x = 0;
+    double y = 0;
+    double z = 0;
+    double kinetic = 0;
+    double potential = 0;
+    int contacts = 0;
+    for (auto it = points.begin(); it != points.end(); ++it) {
+        const double pm = (*it).mass;
+        mass += pm;
+        x += (*it).x * pm;
+        y += (*it).y * pm;
+        z += (*it).z * pm;
+        kinetic += 0.5 * pm * ((*it).vx * (*it).vx + (*it).vy * (*it).vy + (*it).vz * (*it).vz);
+        potential -= pm * physics.gravity * (*it).y;
+        contacts += (*it).y <= 0;
+    }
+    observer.centerOfMass.push_back((float) (x / mass));
+    observer.centerOfMass.push_back((float) (y / mass));
+    observer.centerOfMass.push_back((float) (z / mass));
+    for (auto it = observer.trackedPoints.begin(); it != observer.trackedPoints.end(); ++it) {
+        observer.trajectory.push_back(points[*it].x);
+        observer.trajectory.push_back(points[*it].y);
+        observer.trajectory.push_back(points[*it].z);
+    }
+    if (observer.recordEnergy) {
+        observer.kineticEnergy.push_back((float) kinetic);
+        observer.potentialEnergy.push_back((float) potential);
+    }
+    if (observer.recordContacts) {
+        observer.groundContacts.push_back(contacts);
+    }
+}
+
+// Whether the observer wants the state at the start of this step - one predictable branch a step when there's none
+inline bool sampleDue(SimObserver *observer, float dt) {
+    if (observer == NULL) {
+        return false;
+    }
+    const bool due = observer->untilNextSample <= 0;
+    if (due) {
+        observer->untilNextSample += observer->interval;
+    }
+    observer->untilNextSample -= dt;
+    return due;
+}
+
+void compactSprings(std::vector<Spring>& springs, CompactSprings &compact) {
+    compact.springs.clear();
+    compact.materials.clear();
+    compact.restLengths.clear();
+    compact.springs.reserve(springs.size());
+    for (auto it = springs.begin(); it != springs.end(); ++it) {
+        // A robot has a handful of materials and rest lengths so a scan beats a map and allocates nothing
+        int material = 0;
+        while (material < compact.materials.size()
+            && (compact.materials[material].k != (*it).k || compact.materials[material].flexIndex != (*it).flexIndex)) {
+            material++;
+        }
+        if (material == compact.materials.size()) {
+            compact.materials.push_back({(*it).k, (*it).flexIndex});
+        }
+        int restLength = 0;
+        while (restLength < compact.restLengths.size() && compact.restLengths[restLength] != (*it).l0) {
+            restLength++;
+        }
+        if (restLength == compact.restLengths.size()) {
+            compact.restLengths.push_back((*it).l0);
+        }
+        CompactSpring s = {(unsigned int) (*it).p1, (unsigned int) (*it).p2, (unsigned short) material, (unsigned short) restLength};
+        compact.springs.push_back(s);
+    }
+}
+
+CompactSprings compactSprings(std::vector<Spring>& springs) {
+    CompactSprings compact;
+    compactSprings(springs, compact);
+    return compact;
+}
+
+bool simulateAgainCPP(std::vector<Point>&points, std::vector<Spring>&springs, std::vector<FlexPreset>& presets, double n, double t, float oscillationFrequency, SimOptions options) {
+    thread_local CompactSprings compact;
+    compactSprings(springs, compact);
+    return simulateCompactCPP(points, compact, presets, n, t, oscillationFrequency, options);
 }
 
-bool simulateAgainCPP(std::vector<Point>&points, std::vector<Spring>&springs, std::vector<FlexPreset> presets, double n, double t, float oscillationFrequency) {
+// Buffers for the general and team paths, kept per thread so calls don't reallocate
+struct LargeRobotState {
     std::vector<float> presetValues;
-    for (auto it = presets.begin(); it != presets.end(); it++) {
-        presetValues.push_back(0.0);
+    std::vector<float> materialAdjust;
+    std::vector<float> groundFy;
+    std::vector<int> contacts;
+    std::vector<std::vector<float>> forces; // one per team member
+};
+
+thread_local LargeRobotState largeRobotState;
+
+// simulateCompactCPP for a team of teamSize threads, the calling one included. Each thread owns a contiguous slice of
+// the springs, which it accumulates into its own force buffers, and a slice of the points, which sums the buffers
+// back up. Two barriers a step - one after the springs and one after the points
+bool simulateCompactTeamCPP(std::vector<Point>& points, CompactSprings& springs, std::vector<FlexPreset>& presets, double n, double t, float oscillationFrequency, SimOptions options, SimObserver *observer, int teamSize) {
+    const float dt = options.dt;
+    const float stepDampening = stepDampeningForOptions(options);
+    const PhysicsParameters &physics = options.physics;
+    const bool penalty = options.contact == penaltyContact;
+    const int numPoints = (int) points.size();
+    const int numSprings = (int) springs.springs.size();
+    LargeRobotState &state = largeRobotState;
+    std::vector<float> &materialAdjust = state.materialAdjust;
+    materialAdjust.assign(springs.materials.size(), 1);
+    std::vector<std::vector<float>> &forces = state.forces;
+    if (forces.size() < teamSize) {
+        forces.resize(teamSize);
     }
+    for (int i = 0; i < teamSize; i++) {
+        forces[i].assign(3 * numPoints, 0); // fx, fy, fz per point
+    }
+    std::vector<float> &groundFy = state.groundFy;
+    groundFy.assign(numPoints, 0);
+    state.contacts.resize(numPoints); // each member collects into its own slice
+    std::atomic<bool> torn(false);
+    bool done = false;
+    TeamBarrier barrier(teamSize);
+
+    auto updateAdjust = [&]() {
+        done = t >= n || torn;
+        for (int m = 0; m < springs.materials.size(); m++) {
+            const FlexPreset &preset = presets[springs.materials[m].flexIndex];
+            materialAdjust[m] = preset.a * (1 + preset.b * sin(t * oscillationFrequency + preset.c));
+        }
+    };
+
+    auto work = [&](int member) {
+        const int springStart = (int) ((long long) numSprings * member / teamSize);
+        const int springEnd = (int) ((long long) numSprings * (member + 1) / teamSize);
+        const int pointStart = (int) ((long long) numPoints * member / teamSize);
+        const int pointEnd = (int) ((long long) numPoints * (member + 1) / teamSize);
+        float *force = forces[member].data();
+        int *contacts = state.contacts.data() + pointStart;
+        int numContacts = penalty ? collectContacts(points, pointStart, pointEnd, penalty, contacts) : 0;
+        while (true) {
+            barrier.wait();
+            if (done) {
+                return;
+            }
+            // nothing writes to the points until the next barrier
+            if (member == 0 && sampleDue(observer, dt)) {
+                recordSample(*observer, points, physics);
+            }
+            const SpringMaterial *materials = springs.materials.data();
+            const float *adjust = materialAdjust.data();
+            const float *restLengths = springs.restLengths.data();
+            for (int i = springStart; i < springEnd; i++) {
+                const CompactSpring l = springs.springs[i];
+                const Point &p1 = points[l.p1];
+                const Point &p2 = points[l.p2];
+
+                const float xd = p1.x - p2.x;
+                const float yd = p1.y - p2.y;
+                const float zd = p1.z - p2.z;
+                const float dist = sqrt(xd * xd + yd * yd + zd * zd);
+                const float l0 = restLengths[l.restLength];
+
+                if (dist > (l0 * physics.maxStretch)) {
+                    torn = true;
+                    break;
+                }
+
+                const float f = materials[l.material].k * (dist - (l0 * adjust[l.material]));
+                const float fd = f / dist;
+                const float dx = xd * fd;
+                const float dy = yd * fd;
+                const float dz = zd * fd;
+
+                force[3 * l.p1] -= dx;
+                force[3 * l.p2] += dx;
+                force[3 * l.p1 + 1] -= dy;
+                force[3 * l.p2 + 1] += dy;
+                force[3 * l.p1 + 2] -= dz;
+                force[3 * l.p2 + 2] += dz;
+            }
+            barrier.wait();
+            if (torn) {
+                // leader notices at the top of the loop and everyone leaves together
+                if (member == 0) {
+                    done = true;
+                }
+                continue;
+            }
+            for (int i = pointStart; i < pointEnd; i++) {
+                Point &p = points[i];
+                for (int j = 0; j < teamSize; j++) {
+                    p.fx += forces[j][3 * i];
+                    p.fy += forces[j][3 * i + 1];
+                    p.fz += forces[j][3 * i + 2];
+                    forces[j][3 * i] = 0;
+                    forces[j][3 * i + 1] = 0;
+                    forces[j][3 * i + 2] = 0;
+                }
+            }
+            // contacts only touch their own point so each slice handles its own
+            if (penalty) {
+                for (int c = 0; c < numContacts; c++) {
+                    Point &p = points[contacts[c]];
+                    groundFy[contacts[c]] = penaltyGroundContact(p.fx, p.fy, p.fz, p.y, p.mass, p.us, p.uk, physics);
+                }
+            }
+            for (int i = pointStart; i < pointEnd; i++) {
+                integratePoint(points[i], groundFy[i], dt, stepDampening, physics);
+            }
+            for (int c = 0; c < numContacts; c++) {
+                groundFy[contacts[c]] = 0;
+            }
+            numContacts = collectContacts(points, pointStart, pointEnd, penalty, contacts);
+            if (!penalty) {
+                resolveGroundConstraints(points, contacts, numContacts, dt);
+            }
+            if (member == 0) {
+                t += dt;
+                updateAdjust();
+            }
+        }
+    };
+
+    updateAdjust();
+    std::vector<std::thread> helpers;
+    for (int i = 1; i < teamSize; i++) {
+        helpers.push_back(std::thread(work, i));
+    }
+    work(0);
+    for (auto it = helpers.begin(); it != helpers.end(); ++it) {
+        (*it).join();
+    }
+    return !torn;
+}
+
+// Local copy of a small robot's points, kept per thread so calls don't reallocate. What the spring pass reads and
+// writes for a point (position and force) is packed into one 32 byte slot, so each endpoint is a single cache line
+const int kBodyStride = 8; // x, y, z, fx, fy, fz, the ground's push and padding
+
+struct SmallRobotState {
+    std::vector<float> body;
+    std::vector<float> vx, vy, vz;
+    std::vector<float> mass, uk, us;
+    std::vector<float> springK, materialAdjust; // per material, the adjustment is refreshed each step
+    std::vector<float> presetA, presetB, presetC; // each material's flex preset
+    std::vector<int> contacts;
+};
+
+// simulateCompactCPP for robots small enough to stay in cache. The points are unpacked once into local arrays that
+// every step runs over and are only written back when the call returns, i.e. at the caller's sample points.
+// The step count is worked out up front so the loop doesn't compare doubles. Same arithmetic in the same order as the
+// general path so results are identical.
+// numMaterialsT is kRegisterMaterials to keep the materials in locals (padded out with k = 0) or 0 for any number,
+// defaultPhysics folds kDefaultPhysics in place of options.physics
+template <int numMaterialsT, bool defaultPhysics>
+bool simulateSmallCPP(std::vector<Point>& points, CompactSprings& springs, std::vector<FlexPreset>& presets, double n, double t, float oscillationFrequency, SimOptions options, SimObserver *observer) {
+    thread_local SmallRobotState state;
+    const float dt = options.dt;
+    const PhysicsParameters physics = physicsFor<defaultPhysics>(options.physics);
+    const float stepDampening = stepDampeningForOptions(options);
+    const bool penalty = options.contact == penaltyContact;
+    const int numPoints = (int) points.size();
+    const int numMaterials = numMaterialsT > 0 ? numMaterialsT : (int) springs.materials.size();
+
+    int steps = 0;
+    for (double stepT = t; stepT < n; stepT += dt) {
+        steps++;
+    }
+
+    state.body.resize(kBodyStride * numPoints);
+    state.vx.resize(numPoints);
+    state.vy.resize(numPoints);
+    state.vz.resize(numPoints);
+    state.mass.resize(numPoints);
+    state.uk.resize(numPoints);
+    state.us.resize(numPoints);
+    state.springK.resize(numMaterials);
+    state.materialAdjust.resize(numMaterials);
+    state.presetA.resize(numMaterials);
+    state.presetB.resize(numMaterials);
+    state.presetC.resize(numMaterials);
+    float * const body = state.body.data();
+    float * const vx = state.vx.data();
+    float * const vy = state.vy.data();
+    float * const vz = state.vz.data();
+    float * const mass = state.mass.data();
+    float * const uk = state.uk.data();
+    float * const us = state.us.data();
+    float localK[kRegisterMaterials], localAdjust[kRegisterMaterials];
+    float localA[kRegisterMaterials], localB[kRegisterMaterials], localC[kRegisterMaterials];
+    float * const k = numMaterialsT > 0 ? localK : state.springK.data();
+    float * const adjust = numMaterialsT > 0 ? localAdjust : state.materialAdjust.data();
+    float * const presetA = numMaterialsT > 0 ? localA : state.presetA.data();
+    float * const presetB = numMaterialsT > 0 ? localB : state.presetB.data();
+    float * const presetC = numMaterialsT > 0 ? localC : state.presetC.data();
+    for (int i = 0; i < numPoints; i++) {
+        const Point &p = points[i];
+        float *b = body + kBodyStride * i;
+        b[0] = p.x;
+        b[1] = p.y;
+        b[2] = p.z;
+        b[3] = p.fx;
+        b[4] = p.fy;
+        b[5] = p.fz;
+        vx[i] = p.vx;
+        vy[i] = p.vy;
+        vz[i] = p.vz;
+        mass[i] = p.mass;
+        uk[i] = p.uk;
+        us[i] = p.us;
+    }
+    for (int m = 0; m < numMaterials; m++) {
+        if (m < springs.materials.size()) {
+            const FlexPreset &preset = presets[springs.materials[m].flexIndex];
+            k[m] = springs.materials[m].k;
+            presetA[m] = preset.a;
+            presetB[m] = preset.b;
+            presetC[m] = preset.c;
+        } else {
+            // padding - no spring uses it and it always adjusts by 1
+            k[m] = 0;
+            presetA[m] = 1;
+            presetB[m] = 0;
+            presetC[m] = 0;
+        }
+    }
+    const float *restLengths = springs.restLengths.data();
+    const CompactSpring *springList = springs.springs.data();
+    const int numSprings = (int) springs.springs.size();
+    state.contacts.resize(numPoints);
+    int * const contacts = state.contacts.data();
+    int numContacts = 0;
+    for (int i = 0; penalty && i < numPoints; i++) {
+        body[kBodyStride * i + 6] = 0;
+        contacts[numContacts] = i;
+        numContacts += body[kBodyStride * i + 1] <= 0;
+    }
+
+    bool intact = true;
+    auto writeBack = [&]() {
+        for (int i = 0; i < numPoints; i++) {
+            Point &p = points[i];
+            const float *b = body + kBodyStride * i;
+            p.x = b[0];
+            p.y = b[1];
+            p.z = b[2];
+            p.fx = b[3];
+            p.fy = b[4];
+            p.fz = b[5];
+            p.vx = vx[i];
+            p.vy = vy[i];
+            p.vz = vz[i];
+        }
+    };
+
+    for (int step = 0; step < steps && intact; step++) {
+        if (sampleDue(observer, dt)) {
+            writeBack();
+            recordSample(*observer, points, physics);
+        }
+        for (int m = 0; m < numMaterials; m++) {
+            adjust[m] = presetA[m] * (1 + presetB[m] * sin(t * oscillationFrequency + presetC[m]));
+        }
+        for (int i = 0; i < numSprings; i++) {
+            const CompactSpring l = springList[i];
+            float *b1 = body + kBodyStride * l.p1;
+            float *b2 = body + kBodyStride * l.p2;
+            const float xd = b1[0] - b2[0];
+            const float yd = b1[1] - b2[1];
+            const float zd = b1[2] - b2[2];
+            const float dist = sqrt(xd * xd + yd * yd + zd * zd);
+            const float l0 = restLengths[l.restLength];
+
+            if (dist > (l0 * physics.maxStretch)) {
+                intact = false;
+                break;
+            }
+
+            const float f = k[l.material] * (dist - (l0 * adjust[l.material]));
+            const float fd = f / dist;
+            const float dx = xd * fd;
+            const float dy = yd * fd;
+            const float dz = zd * fd;
+
+            b1[3] -= dx;
+            b2[3] += dx;
+            b1[4] -= dy;
+            b2[4] += dy;
+            b1[5] -= dz;
+            b2[5] += dz;
+        }
+        if (!intact) {
+            break;
+        }
+        for (int c = 0; penalty && c < numContacts; c++) {
+            float *b = body + kBodyStride * contacts[c];
+            b[6] = penaltyGroundContact(b[3], b[4], b[5], b[1], mass[contacts[c]], us[contacts[c]], uk[contacts[c]], physics);
+        }
+        // free flight - everything grounded was taken care of above
+        for (int i = 0; i < numPoints; i++) {
+            float *b = body + kBodyStride * i;
+            float fy = b[4] + physics.gravity * mass[i];
+            fy += b[6];
+            const float fx = b[3];
+            const float fz = b[5];
+            b[3] = 0;
+            b[4] = 0;
+            b[5] = 0;
+            b[6] = 0;
+            vx[i] = (fx / mass[i] * dt + vx[i]) * stepDampening;
+            vy[i] = (fy / mass[i] * dt + vy[i]) * stepDampening;
+            vz[i] = (fz / mass[i] * dt + vz[i]) * stepDampening;
+            b[0] += vx[i] * dt;
+            b[1] += vy[i] * dt;
+            b[2] += vz[i] * dt;
+        }
+        numContacts = 0;
+        for (int i = 0; i < numPoints; i++) {
+            contacts[numContacts] = i;
+            numContacts += penalty ? body[kBodyStride * i + 1] <= 0 : body[kBodyStride * i + 1] < 0;
+        }
+        for (int c = 0; !penalty && c < numContacts; c++) {
+            // same as resolveGroundConstraints
+            const int i = contacts[c];
+            float *b = body + kBodyStride * i;
+            const float jn = vy[i] < 0 ? -vy[i] : 0;
+            b[1] = 0;
+            vy[i] += jn;
+            const float vh = sqrt(vx[i] * vx[i] + vz[i] * vz[i]);
+            const float scale = vh > us[i] * jn ? std::max(0.0f, 1 - uk[i] * jn / vh) : 0;
+            const float dvx = vx[i] * (scale - 1);
+            const float dvz = vz[i] * (scale - 1);
+            vx[i] += dvx;
+            vz[i] += dvz;
+            b[0] += dvx * dt;
+            b[2] += dvz * dt;
+        }
+        t += dt;
+    }
+    writeBack();
+    return intact;
+}
+
+bool simulateCompactCPP(std::vector<Point>& points, CompactSprings& springs, std::vector<FlexPreset>& presets, double n, double t, float oscillationFrequency, SimOptions options, SimObserver *observer) {
+    if (points.size() <= kSmallRobotPoints) {
+        const bool defaultPhysics = isDefaultPhysics(options.physics);
+        if (springs.materials.size() <= kRegisterMaterials) {
+            if (defaultPhysics) {
+                return simulateSmallCPP<kRegisterMaterials, true>(points, springs, presets, n, t, oscillationFrequency, options, observer);
+            }
+            return simulateSmallCPP<kRegisterMaterials, false>(points, springs, presets, n, t, oscillationFrequency, options, observer);
+        }
+        if (defaultPhysics) {
+            return simulateSmallCPP<0, true>(points, springs, presets, n, t, oscillationFrequency, options, observer);
+        }
+        return simulateSmallCPP<0, false>(points, springs, presets, n, t, oscillationFrequency, options, observer);
+    }
+    if (points.size() >= intraRobotThreading.pointThreshold && intraRobotThreading.maxTeamSize > 1 && t < n) {
+        const int helpers = acquireHelperThreads(intraRobotThreading.maxTeamSize - 1);
+        if (helpers > 0) {
+            const bool result = simulateCompactTeamCPP(points, springs, presets, n, t, oscillationFrequency, options, observer, helpers + 1);
+            releaseHelperThreads(helpers);
+            return result;
+        }
+    }
+    const float dt = options.dt;
+    const float stepDampening = stepDampeningForOptions(options);
+    const PhysicsParameters &physics = options.physics;
+    LargeRobotState &state = largeRobotState;
+    std::vector<float> &presetValues = state.presetValues;
+    presetValues.assign(presets.size(), 0.0);
+    std::vector<float> &materialAdjust = state.materialAdjust;
+    materialAdjust.assign(springs.materials.size(), 1);
+    const bool penalty = options.contact == penaltyContact;
+    const int numPoints = (int) points.size();
+    std::vector<int> &contacts = state.contacts;
+    contacts.resize(numPoints);
+    std::vector<float> &groundFy = state.groundFy;
+    groundFy.assign(numPoints, 0);
+    int numContacts = penalty ? collectContacts(points, 0, numPoints, penalty, contacts.data()) : 0;
     while (t < n) {
+        if (sampleDue(observer, dt)) {
+            recordSample(*observer, points, physics);
+        }
         for (int i = 0; i < presetValues.size(); i++) {
             const float a = presets[i].a;
             const float b = presets[i].b;
             const float c = presets[i].c;
             presetValues[i] = a * (1 + b * sin(t * oscillationFrequency + c));
         }
-        for (std::vector<Spring>::iterator i = springs.begin(); i != springs.end(); ++i) {
-            Spring l = *i;
+        for (int m = 0; m < springs.materials.size(); m++) {
+            materialAdjust[m] = presetValues[springs.materials[m].flexIndex];
+        }
+        const SpringMaterial *materials = springs.materials.data();
+        const float *adjust = materialAdjust.data();
+        const float *restLengths = springs.restLengths.data();
+        for (std::vector<CompactSpring>::iterator i = springs.springs.begin(); i != springs.springs.end(); ++i) {
+            CompactSpring l = *i;
 
             const int p1index = l.p1;
             const int p2index = l.p2;
@@ -38,13 +714,14 @@ bool simulateAgainCPP(std::vector<Point>&points, std::vector<Spring>&springs, st
             const float yd = p1.y - p2.y;
             const float zd = p1.z - p2.z;
             const float dist = sqrt(xd * xd + yd * yd + zd * zd);
+            const float l0 = restLengths[l.restLength];
 
-            if (dist > (l.l0 * 6)) {
+            if (dist > (l0 * physics.maxStretch)) {
                 return false;
             }
 
             // negative if repelling, positive if attracting
-            const float f = l.k * (dist - (l.l0 * presetValues[l.flexIndex]));
+            const float f = materials[l.material].k * (dist - (l0 * adjust[l.material]));
             const float fd = f / dist;
             // distribute force across the axes
             const float dx = xd * fd;
@@ -60,48 +737,250 @@ bool simulateAgainCPP(std::vector<Point>&points, std::vector<Spring>&springs, st
             points[p1index].fz -= dz;
             points[p2index].fz += dz;
         }
-        for (std::vector<Point>::iterator i = points.begin(); i != points.end(); ++i) {
-            Point p = *i;
-        
-            const float mass = p.mass;
-            const float y = p.y;
-            float fy = p.fy + gravity * mass;
-            float fx = p.fx;
-            float fz = p.fz;
-            float vx = p.vx;
-            float vy = p.vy;
-            float vz = p.vz;
-
-            if (y <= 0) {
-                double fh = sqrt(fx * fx + fz * fz);
-                const float fyfric = abs(fy * p.us);
-                if (fh < fyfric) {
-                    fx = 0;
-                    fz = 0;
-                } else {
-                    const float fykinetic = abs(fy * p.uk) / fh;
-                    fx = fx - fx * fykinetic;
-                    fz = fz - fz * fykinetic;
-                }
-                fy += kGround * y;
-            }
-            const float ax = fx / mass;
-            const float ay = fy / mass;
-            const float az = fz / mass;
-            // reset the force cache
-            p.fx = 0;
-            p.fy = 0;
-            p.fz = 0;
-            vx = (ax * dt + vx) * dampening;
-            vy = (ay * dt + vy) * dampening;
-            vz = (az * dt + vz) * dampening;
-            p.vx = vx;
-            p.vy = vy;
-            p.vz = vz;
-            p.x += vx * dt;
-            p.y += vy * dt;
-            p.z += vz * dt;
-            *i = p;
+        if (penalty) {
+            for (int c = 0; c < numContacts; c++) {
+                Point &p = points[contacts[c]];
+                groundFy[contacts[c]] = penaltyGroundContact(p.fx, p.fy, p.fz, p.y, p.mass, p.us, p.uk, physics);
+            }
+        }
+        for (int i = 0; i < numPoints; i++) {
+            integratePoint(points[i], groundFy[i], dt, stepDampening, physics);
+        }
+        for (int c = 0; c < numContacts; c++) {
+            groundFy[contacts[c]] = 0;
+        }
+        numContacts = collectContacts(points, 0, numPoints, penalty, contacts.data());
+        if (!penalty) {
+            resolveGroundConstraints(points, contacts.data(), numContacts, dt);
+        }
+        t += dt;
+    }
+    return true;
+}
+
+// Interleaved state for simulateControlLanesCPP - element i * kControlLanes + lane, kept per thread
+struct ControlLaneState {
+    std::vector<float> x, y, z;
+    std::vector<float> vx, vy, vz;
+    std::vector<float> fx, fy, fz;
+    std::vector<float> mass, us, uk; // per point, shared by every lane
+    std::vector<float> presetValues;
+    std::vector<float> materialAdjust;
+};
+
+// Ground contact and integration of every point in every lane - integratePoint plus whichever contact model, worked
+// out for every lane and kept only where the point is touching the ground
+template <bool penalty>
+void integrateControlLanes(ControlLaneState &state, int numPoints, float dt, float stepDampening, const PhysicsParameters &physics) {
+    const int lanes = kControlLanes;
+    float *x = state.x.data();
+    float *y = state.y.data();
+    float *z = state.z.data();
+    float *vx = state.vx.data();
+    float *vy = state.vy.data();
+    float *vz = state.vz.data();
+    float *fx = state.fx.data();
+    float *fy = state.fy.data();
+    float *fz = state.fz.data();
+    for (int i = 0; i < numPoints; i++) {
+        const float mass = state.mass[i];
+        const float us = state.us[i];
+        const float uk = state.uk[i];
+        for (int e = i * lanes; e < (i + 1) * lanes; e++) {
+            float pfx = fx[e];
+            float pfz = fz[e];
+            float groundFy = 0;
+            if (penalty) {
+                float cfx = pfx;
+                float cfz = pfz;
+                const float push = penaltyGroundContact(cfx, fy[e], cfz, y[e], mass, us, uk, physics);
+                const bool contact = y[e] <= 0;
+                pfx = contact ? cfx : pfx;
+                pfz = contact ? cfz : pfz;
+                groundFy = contact ? push : 0;
+            }
+            float pfy = fy[e] + physics.gravity * mass;
+            pfy += groundFy;
+            const float ax = pfx / mass;
+            const float ay = pfy / mass;
+            const float az = pfz / mass;
+            fx[e] = 0;
+            fy[e] = 0;
+            fz[e] = 0;
+            float nvx = (ax * dt + vx[e]) * stepDampening;
+            float nvy = (ay * dt + vy[e]) * stepDampening;
+            float nvz = (az * dt + vz[e]) * stepDampening;
+            float nx = x[e] + nvx * dt;
+            float ny = y[e] + nvy * dt;
+            float nz = z[e] + nvz * dt;
+            if (!penalty) {
+                // resolveGroundConstraints for the lanes that ended the step under the ground
+                const bool under = ny < 0;
+                const float jn = nvy < 0 ? -nvy : 0;
+                const float vh = sqrt(nvx * nvx + nvz * nvz);
+                const float scale = vh > us * jn ? std::max(0.0f, 1 - uk * jn / vh) : 0;
+                const float dvx = nvx * (scale - 1);
+                const float dvz = nvz * (scale - 1);
+                ny = under ? 0 : ny;
+                nvy = under ? nvy + jn : nvy;
+                nvx = under ? nvx + dvx : nvx;
+                nvz = under ? nvz + dvz : nvz;
+                nx = under ? nx + dvx * dt : nx;
+                nz = under ? nz + dvz * dt : nz;
+            }
+            vx[e] = nvx;
+            vy[e] = nvy;
+            vz[e] = nvz;
+            x[e] = nx;
+            y[e] = ny;
+            z[e] = nz;
+        }
+    }
+}
+
+// The loops over lanes are branch free with a constant trip count so the compiler vectorizes them. Per lane it's the
+// general path's arithmetic in the general path's order, so each lane matches simulateCompactCPP
+void simulateControlLanesCPP(std::vector<Point> *points, CompactSprings &springs, std::vector<FlexPreset> *presets, const float *frequencies, const double *ends, double t, SimOptions options, bool *intact) {
+    const int lanes = kControlLanes;
+    thread_local ControlLaneState state;
+    const float dt = options.dt;
+    const float stepDampening = stepDampeningForOptions(options);
+    const PhysicsParameters &physics = options.physics;
+    const bool penalty = options.contact == penaltyContact;
+    const int numPoints = (int) points[0].size();
+    const int numPresets = (int) presets[0].size();
+    const int numMaterials = (int) springs.materials.size();
+
+    std::vector<float> *fields[] = {&state.x, &state.y, &state.z, &state.vx, &state.vy, &state.vz, &state.fx, &state.fy, &state.fz};
+    for (int f = 0; f < 9; f++) {
+        fields[f]->resize(numPoints * lanes);
+    }
+    state.mass.resize(numPoints);
+    state.us.resize(numPoints);
+    state.uk.resize(numPoints);
+    state.presetValues.resize(numPresets * lanes);
+    state.materialAdjust.resize(numMaterials * lanes);
+    float *x = state.x.data();
+    float *y = state.y.data();
+    float *z = state.z.data();
+    float *vx = state.vx.data();
+    float *vy = state.vy.data();
+    float *vz = state.vz.data();
+    float *fx = state.fx.data();
+    float *fy = state.fy.data();
+    float *fz = state.fz.data();
+    for (int i = 0; i < numPoints; i++) {
+        state.mass[i] = points[0][i].mass;
+        state.us[i] = points[0][i].us;
+        state.uk[i] = points[0][i].uk;
+        for (int lane = 0; lane < lanes; lane++) {
+            const Point &p = points[lane][i];
+            const int e = i * lanes + lane;
+            x[e] = p.x;
+            y[e] = p.y;
+            z[e] = p.z;
+            vx[e] = p.vx;
+            vy[e] = p.vy;
+            vz[e] = p.vz;
+            fx[e] = p.fx;
+            fy[e] = p.fy;
+            fz[e] = p.fz;
+        }
+    }
+    auto finishLane = [&](int lane) {
+        for (int i = 0; i < numPoints; i++) {
+            Point &p = points[lane][i];
+            const int e = i * lanes + lane;
+            p.x = x[e];
+            p.y = y[e];
+            p.z = z[e];
+            p.vx = vx[e];
+            p.vy = vy[e];
+            p.vz = vz[e];
+            p.fx = fx[e];
+            p.fy = fy[e];
+            p.fz = fz[e];
+        }
+    };
+
+    bool running[kControlLanes];
+    for (int lane = 0; lane < lanes; lane++) {
+        intact[lane] = true;
+        running[lane] = true;
+    }
+    const SpringMaterial *materials = springs.materials.data();
+    const float *restLengths = springs.restLengths.data();
+    float *presetValues = state.presetValues.data();
+    float *materialAdjust = state.materialAdjust.data();
+    while (true) {
+        bool anyRunning = false;
+        for (int lane = 0; lane < lanes; lane++) {
+            if (running[lane] && !(t < ends[lane])) {
+                finishLane(lane);
+                running[lane] = false;
+            }
+            anyRunning = anyRunning || running[lane];
+        }
+        if (!anyRunning) {
+            return;
+        }
+        for (int i = 0; i < numPresets; i++) {
+            for (int lane = 0; lane < lanes; lane++) {
+                const float a = presets[lane][i].a;
+                const float b = presets[lane][i].b;
+                const float c = presets[lane][i].c;
+                presetValues[i * lanes + lane] = a * (1 + b * sin(t * frequencies[lane] + c));
+            }
+        }
+        for (int m = 0; m < numMaterials; m++) {
+            for (int lane = 0; lane < lanes; lane++) {
+                materialAdjust[m * lanes + lane] = presetValues[springs.materials[m].flexIndex * lanes + lane];
+            }
+        }
+        int overstretched[kControlLanes] = {0};
+        for (std::vector<CompactSpring>::iterator i = springs.springs.begin(); i != springs.springs.end(); ++i) {
+            const CompactSpring l = *i;
+            const int e1 = l.p1 * lanes;
+            const int e2 = l.p2 * lanes;
+            const float k = materials[l.material].k;
+            const float l0 = restLengths[l.restLength];
+            const float maxLength = l0 * physics.maxStretch;
+            const float *adjust = materialAdjust + l.material * lanes;
+            float dx[kControlLanes], dy[kControlLanes], dz[kControlLanes];
+            for (int lane = 0; lane < lanes; lane++) {
+                const float xd = x[e1 + lane] - x[e2 + lane];
+                const float yd = y[e1 + lane] - y[e2 + lane];
+                const float zd = z[e1 + lane] - z[e2 + lane];
+                const float dist = sqrt(xd * xd + yd * yd + zd * zd);
+                overstretched[lane] |= dist > maxLength;
+                // negative if repelling, positive if attracting
+                const float f = k * (dist - (l0 * adjust[lane]));
+                const float fd = f / dist;
+                dx[lane] = xd * fd;
+                dy[lane] = yd * fd;
+                dz[lane] = zd * fd;
+            }
+            for (int lane = 0; lane < lanes; lane++) {
+                fx[e1 + lane] -= dx[lane];
+                fx[e2 + lane] += dx[lane];
+                fy[e1 + lane] -= dy[lane];
+                fy[e2 + lane] += dy[lane];
+                fz[e1 + lane] -= dz[lane];
+                fz[e2 + lane] += dz[lane];
+            }
+        }
+        for (int lane = 0; lane < lanes; lane++) {
+            if (running[lane] && overstretched[lane]) {
+                // the general path gives up on the spot too
+                intact[lane] = false;
+                running[lane] = false;
+                finishLane(lane);
+            }
+        }
+        if (penalty) {
+            integrateControlLanes<true>(state, numPoints, dt, stepDampening, physics);
+        } else {
+            integrateControlLanes<false>(state, numPoints, dt, stepDampening, physics);
         }
         t += dt;
     }
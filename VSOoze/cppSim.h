@@ -34,9 +34,91 @@ struct FlexPreset {
     const float c;
 };*/
 
+// Spring as streamed by the cpu engine - k and flex preset come from a per-robot material table and l0 from a
+// table of the distinct rest lengths (a handful on the lattice), so each record is 12 bytes instead of 28
+struct CompactSpring {
+    unsigned int p1; // Index of first point
+    unsigned int p2; // Index of second point
+    unsigned short material;
+    unsigned short restLength;
+};
+
+struct SpringMaterial {
+    float k; // N/m
+    int flexIndex;
+};
+
+struct CompactSprings {
+    std::vector<CompactSpring> springs;
+    std::vector<SpringMaterial> materials;
+    std::vector<float> restLengths; // meters
+};
+
+// Big robots split each step's spring and point passes across a team of threads that lives for the whole call
+struct IntraRobotThreading {
+    int pointThreshold; // robots with fewer points always run on the calling thread
+    int maxTeamSize; // threads per robot, including the calling one
+    int helperBudget; // helper threads shared by every robot being simulated at once
+};
+
+// Call before any simulation is running
+void configureIntraRobotThreading(IntraRobotThreading config);
+
+// Samples the robot every interval seconds of simulated time while simulateCompactCPP runs, starting with its state
+// when the sim starts. Buffers are sized on the first sample so later ones never allocate - samples past capacity are dropped
+struct SimObserver {
+    double interval; // seconds
+    double untilNextSample; // seconds, carried across calls so a run split into several calls samples evenly
+    bool recordEnergy;
+    bool recordContacts;
+    std::vector<int> trackedPoints; // points whose positions are recorded
+    int capacity;
+    int numSamples;
+    std::vector<float> centerOfMass; // x, y, z per sample
+    std::vector<float> trajectory; // x, y, z of each tracked point per sample
+    std::vector<float> kineticEnergy; // J per sample
+    std::vector<float> potentialEnergy; // J per sample, gravitational only
+    std::vector<int> groundContacts; // points at or below the ground per sample
+};
+
+// Enough room for duration seconds of samples
+SimObserver createSimObserver(double interval, double duration, std::vector<int> trackedPoints, bool recordEnergy, bool recordContacts);
+
+void recordSample(SimObserver &observer, std::vector<Point> &points, const PhysicsParameters &physics);
+
+// Lossless - every spring keeps its exact k, l0 and flex preset
+CompactSprings compactSprings(std::vector<Spring> &springs);
+
+// Same, refilling compact in place so a caller compacting robot after robot keeps its buffers
+void compactSprings(std::vector<Spring> &springs, CompactSprings &compact);
+
 // Updates the x, y, and z values of the points after running a simulation for n seconds
-bool simulateCPP(std::vector<Point> &points, std::vector<Spring> &springs, std::vector<FlexPreset> presets, double n, float oscillationFrequency);
+bool simulateCPP(std::vector<Point> &points, std::vector<Spring> &springs, std::vector<FlexPreset> &presets, double n, float oscillationFrequency, SimOptions options = kDefaultSimOptions);
+
+bool simulateAgainCPP(std::vector<Point>& points, std::vector<Spring>& springs, std::vector<FlexPreset>& presets, double n, double t, float oscillationFrequency, SimOptions options = kDefaultSimOptions);
+
+// simulateAgainCPP for springs that have already been compacted. Pass an observer to sample the robot along the way
+bool simulateCompactCPP(std::vector<Point>& points, CompactSprings& springs, std::vector<FlexPreset>& presets, double n, double t, float oscillationFrequency, SimOptions options = kDefaultSimOptions, SimObserver *observer = NULL);
+
+// Control variants of one robot run side by side, one per SIMD lane - they share the points' masses and frictions and
+// every spring, each lane having its own flex presets and oscillation frequency. State is interleaved lane by lane so
+// each spring's indices, rest length and stiffness are loaded once for all kControlLanes robots
+const int kControlLanes = 8;
+
+// Arrays of kControlLanes. Lane l runs from t until ends[l] - the same steps simulateCompactCPP would take - and
+// points[l] comes back with its final state. intact[l] is false if that lane tore itself apart, which leaves its
+// points meaningless but doesn't stop the others. No observer
+void simulateControlLanesCPP(std::vector<Point> *points, CompactSprings &springs, std::vector<FlexPreset> *presets, const float *frequencies, const double *ends, double t, SimOptions options, bool *intact);
+
+// Largest dt the symplectic integrator can take for this robot, derived from its stiffest point relative to its mass.
+// Never smaller than the default step and capped so presets and frame captures are still sampled finely
+float stableTimestep(std::vector<Point> &points, std::vector<Spring> &springs, ContactModel contact = penaltyContact, PhysicsParameters physics = kDefaultPhysics);
+
+// Building blocks of stableTimestep shared with the other engines
+double pointOmegaSquared(double springStiffness, float mass, ContactModel contact, const PhysicsParameters &physics);
+float timestepForOmegaSquared(double maxOmegaSquared);
 
-bool simulateAgainCPP(std::vector<Point>& points, std::vector<Spring>& springs, std::vector<FlexPreset> presets, double n, double t, float oscillationFrequency);
+// Per-robot options for the symplectic integrator - falls back to the fixed default dt for eulerIntegrator
+SimOptions simOptionsForRobot(std::vector<Point> &points, std::vector<Spring> &springs, SimIntegrator integrator, ContactModel contact = penaltyContact, PhysicsParameters physics = kDefaultPhysics);
 
 #endif
\ No newline at end of file
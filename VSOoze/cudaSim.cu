@@ -8,6 +8,7 @@
 #include <map>
 #include <chrono>
 #include <limits>
+#include <algorithm>
 #include <cuda_runtime.h>
 
 #include "cudaSim.h"
@@ -25,21 +26,23 @@ static void HandleError( cudaError_t err,
 }
 #define HANDLE_ERROR( err ) (HandleError( err, __FILE__, __LINE__ ))
 
-#define dt 0.0001
-#define dampening 0.999
-#define gravity -9.81
-#define kGround -100000.0
+// Flex preset values for one step, passed by value so they land in the kernel's constant bank
+const int kMaxKernelPresets = 16;
+struct KernelPresets {
+    float values[kMaxKernelPresets];
+    int count;
+};
 
+// numPresets is the compile time preset count (4 - one per box) or 0 for whatever presets.count says
+template <int numPresets>
 __global__ void update_spring(
     Point *points,
     Spring *springs,
     SpringDelta *springDeltas,
     int n,
     int *invalid,
-    double preset0,
-    double preset1,
-    double preset2,
-    double preset3) {
+    KernelPresets presets,
+    float maxStretch) {
     int i = blockIdx.x * blockDim.x + threadIdx.x;
     if (i >= n) return;
 
@@ -54,29 +57,22 @@ __global__ void update_spring(
 
     float dist = sqrt(dx * dx + dy * dy + dz * dz);
     
-    if (dist > (s.l0 * 6)) {
+    if (dist > (s.l0 * maxStretch)) {
         bool firstInvalidation = atomicCAS(invalid, 0, 1);
         return;
     }
 
     // negative if repelling, positive if attracting
-    float adjust;
-    switch (s.flexIndex) {
-        case 0:
-            adjust = preset0;
-            break;
-        case 1:
-            adjust = preset1;
-            break;
-        case 2:
-            adjust = preset2;
-            break;
-        case 3:
-            adjust = preset3;
-            break;
-        default:
-            adjust = 1;
-            break;
+    float adjust = 1;
+    if (numPresets > 0) {
+        #pragma unroll
+        for (int p = 0; p < numPresets; p++) {
+            if (s.flexIndex == p) {
+                adjust = presets.values[p];
+            }
+        }
+    } else if (s.flexIndex < presets.count) {
+        adjust = presets.values[s.flexIndex];
     }
     float f = s.k * (dist - (s.l0 * adjust));
 
@@ -90,7 +86,9 @@ __global__ void update_spring(
     springDeltas[p2.springDeltaIndex + s.p2SpringIndex] = {xd, yd, zd};
 }
 
-__global__ void update_point(Point *points, SpringDelta *springDeltas, int n) {
+// The physics can't be a template parameter (floats) but as arguments they're uniform loads from the constant bank
+template <ContactModel contact>
+__global__ void update_point(Point *points, SpringDelta *springDeltas, int n, float dt, float stepDampening, PhysicsParameters physics) {
     int i = blockIdx.x * blockDim.x + threadIdx.x;
     if (i >= n) return;
 
@@ -99,7 +97,7 @@ __global__ void update_point(Point *points, SpringDelta *springDeltas, int n) {
 	float mass = p.mass;
     float fx = 0;
     float fz = 0;
-    float fy = gravity * mass;
+    float fy = physics.gravity * mass;
     int startIndex = p.springDeltaIndex;
     int done = p.numSprings + startIndex;
     for (int j = startIndex; j < done; j++) {
@@ -115,7 +113,7 @@ __global__ void update_point(Point *points, SpringDelta *springDeltas, int n) {
     float vy = p.vy;
     float vz = p.vz;
 
-    if (y <= 0) {
+    if (contact == penaltyContact && y <= 0) {
         float fh = sqrt(fx * fx + fz * fz);
         float fyfric = abs(fy * p.us);
         if (fh < fyfric) {
@@ -126,24 +124,68 @@ __global__ void update_point(Point *points, SpringDelta *springDeltas, int n) {
             fx = fx - fx * fykinetic;
             fz = fz - fz * fykinetic;
         }
-        fy += kGround * y;
+        fy += physics.groundStiffness * y;
     }
     float ax = fx / mass;
     float ay = fy / mass;
     float az = fz / mass;
 
-    vx = (ax * dt + vx) * dampening;
+    vx = (ax * dt + vx) * stepDampening;
     p.vx = vx;
-    vy = (ay * dt + vy) * dampening;
+    vy = (ay * dt + vy) * stepDampening;
     p.vy = vy;
-    vz = (az * dt + vz) * dampening;
+    vz = (az * dt + vz) * stepDampening;
     p.vz = vz;
     p.x += vx * dt;
     p.y += vy * dt;
     p.z += vz * dt;
+    if (contact == constraintContact && p.y < 0) {
+        // Project out of the ground - the velocity into it is the normal impulse that bounds Coulomb friction
+        float jn = p.vy < 0 ? -p.vy : 0;
+        p.y = 0;
+        p.vy += jn;
+        float vh = sqrt(p.vx * p.vx + p.vz * p.vz);
+        float scale = 0;
+        if (vh > p.us * jn) {
+            scale = fmaxf(0.0f, 1 - p.uk * jn / vh); // uk can exceed us - friction only ever stops the point
+        }
+        float dvx = p.vx * (scale - 1);
+        float dvz = p.vz * (scale - 1);
+        p.vx += dvx;
+        p.vz += dvz;
+        p.x += dvx * dt;
+        p.z += dvz * dt;
+    }
     points[i] = p;
 }
 
+KernelPresets kernelPresets(std::vector<FlexPreset> &presets, double t, double oscillationFrequency) {
+    KernelPresets pv;
+    // Springs flexed by presets past the limit keep their rest length
+    pv.count = std::min((int) presets.size(), kMaxKernelPresets);
+    for (int i = 0; i < pv.count; i++) {
+        const float a = presets[i].a;
+        const float b = presets[i].b;
+        const float c = presets[i].c;
+        pv.values[i] = (float) (a * (1 + b * sin(t * oscillationFrequency + c)));
+    }
+    return pv;
+}
+
+// One step - picks the kernels specialized for the common preset count and the contact model
+void launchStep(AsyncSimHandle &handle, KernelPresets &pv, int numSpringBlocks, int numSpringThreads, int numPointBlocks, int numPointThreads, SimOptions &options, float stepDampening) {
+    if (pv.count == 4) {
+        update_spring<4><<<numSpringBlocks, numSpringThreads>>>(handle.p_d, handle.s_d, handle.ps_d, handle.numSprings, handle.b_d, pv, options.physics.maxStretch);
+    } else {
+        update_spring<0><<<numSpringBlocks, numSpringThreads>>>(handle.p_d, handle.s_d, handle.ps_d, handle.numSprings, handle.b_d, pv, options.physics.maxStretch);
+    }
+    if (options.contact == penaltyContact) {
+        update_point<penaltyContact><<<numPointBlocks, numPointThreads>>>(handle.p_d, handle.ps_d, handle.numPoints, options.dt, stepDampening, options.physics);
+    } else {
+        update_point<constraintContact><<<numPointBlocks, numPointThreads>>>(handle.p_d, handle.ps_d, handle.numPoints, options.dt, stepDampening, options.physics);
+    }
+}
+
 AsyncSimHandle createSimHandle(int i, int numPoints, int numSprings) {
     Point *p_d;
     Spring *s_d;
@@ -180,7 +222,7 @@ void releaseSimHandle(AsyncSimHandle &handle) {
     free(handle.startPoints);
 }
 
-void simulate(AsyncSimHandle &handle, std::vector<Point> &points, std::vector<Spring> &springs, std::vector<FlexPreset> &presets, double n, double oscillationFrequency) {
+void simulate(AsyncSimHandle &handle, std::vector<Point> &points, std::vector<Spring> &springs, std::vector<FlexPreset> &presets, double n, double oscillationFrequency, SimOptions options) {
     int psSize = springs.size() * 2;
     int springDeltaIndex = 0;
     for (int i = 0; i < points.size(); i++) {
@@ -189,6 +231,8 @@ void simulate(AsyncSimHandle &handle, std::vector<Point> &points, std::vector<Sp
     }
     HANDLE_ERROR(cudaSetDevice(handle.device));
 
+    const float dt = options.dt;
+    const float stepDampening = stepDampeningForOptions(options);
     double t = 0;
     int numPointThreads = 12;
     int numPointBlocks = handle.numPoints / numPointThreads + 1;
@@ -196,23 +240,13 @@ void simulate(AsyncSimHandle &handle, std::vector<Point> &points, std::vector<Sp
     int numSpringThreads = 25;
     int numSpringBlocks = handle.numSprings / numSpringThreads + 1;
 
-    std::vector<float> pv;
-    for (auto it = presets.begin(); it != presets.end(); it++) {
-        pv.push_back(0.0);
-    }
     HANDLE_ERROR(cudaMemcpyAsync(handle.p_d, &points[0], handle.numPoints * sizeof(Point), cudaMemcpyHostToDevice));
     HANDLE_ERROR(cudaMemcpyAsync(handle.s_d, &springs[0], handle.numSprings * sizeof(Spring), cudaMemcpyHostToDevice));
     HANDLE_ERROR(cudaMemsetAsync(handle.b_d, 0, sizeof(int)));
 
     while (t < n) {
-        for (int i = 0; i < pv.size(); i++) {
-            const float a = presets[i].a;
-            const float b = presets[i].b;
-            const float c = presets[i].c; 
-            pv[i] = (float) (a * (1 + b * sin(t * oscillationFrequency + c)));
-        }
-        update_spring<<<numSpringBlocks, numSpringThreads>>>(handle.p_d, handle.s_d, handle.ps_d, handle.numSprings, handle.b_d, pv[0], pv[1], pv[2], pv[3]);
-        update_point<<<numPointBlocks, numPointThreads>>>(handle.p_d, handle.ps_d, handle.numPoints);
+        KernelPresets pv = kernelPresets(presets, t, oscillationFrequency);
+        launchStep(handle, pv, numSpringBlocks, numSpringThreads, numPointBlocks, numPointThreads, options, stepDampening);
         if (t < 1.0 && t + dt >= 1.0) {
             HANDLE_ERROR(cudaMemcpy(handle.startPoints, handle.p_d, handle.numPoints * sizeof(Point), cudaMemcpyDeviceToHost));
         }
@@ -228,7 +262,7 @@ void simulate(AsyncSimHandle &handle, std::vector<Point> &points, std::vector<Sp
     }
 }
 
-void simulateAgain(AsyncSimHandle &handle, std::vector<FlexPreset> &presets, double t, double n, double oscillationFrequency) {
+void simulateAgain(AsyncSimHandle &handle, std::vector<FlexPreset> &presets, double t, double n, double oscillationFrequency, SimOptions options) {
     int numPoints = handle.numPoints;
     int numPointThreads = 120;
     int numPointBlocks = numPoints / numPointThreads + 1;
@@ -236,21 +270,12 @@ void simulateAgain(AsyncSimHandle &handle, std::vector<FlexPreset> &presets, dou
     int numSpringThreads = 250;
     int numSpringBlocks = handle.numSprings / numSpringThreads + 1;
 
-    std::vector<float> pv;
-    for (auto it = presets.begin(); it != presets.end(); it++) {
-        pv.push_back(0.0);
-    }
-
+    const float dt = options.dt;
+    const float stepDampening = stepDampeningForOptions(options);
     HANDLE_ERROR(cudaSetDevice(handle.device));
     while (t < n) {
-        for (int i = 0; i < pv.size(); i++) {
-            const float a = presets[i].a;
-            const float b = presets[i].b;
-            const float c = presets[i].c; 
-            pv[i] = (float) (a * (1 + b * sin(t * oscillationFrequency + c)));
-        }
-        update_spring<<<numSpringBlocks, numSpringThreads>>>(handle.p_d, handle.s_d, handle.ps_d, handle.numSprings, handle.b_d, pv[0], pv[1], pv[2], pv[3]);
-        update_point<<<numPointBlocks, numPointThreads>>>(handle.p_d, handle.ps_d, numPoints);
+        KernelPresets pv = kernelPresets(presets, t, oscillationFrequency);
+        launchStep(handle, pv, numSpringBlocks, numSpringThreads, numPointBlocks, numPointThreads, options, stepDampening);
         t += dt;
     }
     HANDLE_ERROR(cudaMemcpy(handle.endPoints, handle.p_d, handle.numPoints * sizeof(Point), cudaMemcpyDeviceToHost));
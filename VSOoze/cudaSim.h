@@ -2,6 +2,7 @@
 #define CUDA_SIM
 
 #include <vector>
+#include <cmath>
 
 struct Point {
   float x; // meters
@@ -36,6 +37,52 @@ struct FlexPreset {
   const float c;
 };
 
+enum SimIntegrator {
+  eulerIntegrator, // original update - dampening is applied per 0.1ms step so it only holds at the default dt
+  symplecticIntegrator, // semi-implicit Euler with dampening expressed per simulated second so any dt behaves the same
+};
+
+enum ContactModel {
+  penaltyContact, // stiff ground spring (groundStiffness) plus friction forces - the ground stiffness limits dt
+  constraintContact, // penetration is projected out and Coulomb friction applied as a velocity change
+};
+
+// The world every engine simulates - the one place these constants are defined
+struct PhysicsParameters {
+  float gravity; // m/s^2
+  float groundStiffness; // N/m pushing back on points below the ground (penalty contact), negative
+  float dampening; // fraction of velocity kept per kDefaultTimestep
+  float maxStretch; // a spring stretched past this many rest lengths invalidates the sim
+};
+
+const PhysicsParameters kDefaultPhysics = {-9.81f, -100000.0f, 0.999f, 6.0f};
+
+// The engines dispatch to kernels with these constants folded in when nothing was changed
+inline bool isDefaultPhysics(const PhysicsParameters &physics) {
+  return physics.gravity == kDefaultPhysics.gravity
+    && physics.groundStiffness == kDefaultPhysics.groundStiffness
+    && physics.dampening == kDefaultPhysics.dampening
+    && physics.maxStretch == kDefaultPhysics.maxStretch;
+}
+
+struct SimOptions {
+  float dt; // seconds
+  SimIntegrator integrator;
+  ContactModel contact;
+  PhysicsParameters physics;
+};
+
+const float kDefaultTimestep = 0.0001f;
+const SimOptions kDefaultSimOptions = {kDefaultTimestep, eulerIntegrator, penaltyContact, kDefaultPhysics};
+
+inline float stepDampeningForOptions(const SimOptions &options) {
+  // The original integrator damps once per step, the symplectic one keeps the same decay per simulated second
+  if (options.integrator == eulerIntegrator) {
+    return options.physics.dampening;
+  }
+  return (float) pow(options.physics.dampening, options.dt / kDefaultTimestep);
+}
+
 struct SpringDelta {
   float dx;
   float dy;
@@ -61,9 +108,9 @@ AsyncSimHandle createSimHandle(int i, int numPoints, int numSprings);
 void releaseSimHandle(AsyncSimHandle &handle);
 
 // Updates the x, y, and z values of the points after running a simulation for n seconds
-void simulate(AsyncSimHandle &handle, std::vector<Point> &points, std::vector<Spring> &springs, std::vector<FlexPreset> &presets, double n, double oscillationFrequency);
+void simulate(AsyncSimHandle &handle, std::vector<Point> &points, std::vector<Spring> &springs, std::vector<FlexPreset> &presets, double n, double oscillationFrequency, SimOptions options = kDefaultSimOptions);
 
 // Continue it's current simulation
-void simulateAgain(AsyncSimHandle &handle, std::vector<FlexPreset> &presets, double t, double n, double oscillationFrequency);
+void simulateAgain(AsyncSimHandle &handle, std::vector<FlexPreset> &presets, double t, double n, double oscillationFrequency, SimOptions options = kDefaultSimOptions);
 
 #endif
@@ -7,44 +7,104 @@
 #include <chrono>
 #include <thread>
 #include <future>
+#include <algorithm>
 
 #include "OozebotEncoding.h"
 #include "ParetoSelector.h"
+#include "Conformance.h"
+#include "SimBackend.h"
+#include "Pipeline.h"
+#include "Surrogate.h"
+#include "EvaluationLog.h"
+#include "Metrics.h"
+#include "Trace.h"
 
-// Usage: nvcc -O2 evoAlgo.cpp -o evoAlgo -ccbin "C:\Program Files (x86)\Microsoft Visual Studio\2019\Community\VC\Tools\MSVC\14.27.29110\bin\Hostx64\x64" cudaSim.cu OozebotEncoding.cpp ParetoSelector.cpp ParetoFront.cpp
+// Usage: nvcc -O2 evoAlgo.cpp -o evoAlgo -ccbin "C:\Program Files (x86)\Microsoft Visual Studio\2019\Community\VC\Tools\MSVC\14.27.29110\bin\Hostx64\x64" cudaSim.cu OozebotEncoding.cpp ParetoSelector.cpp ParetoFront.cpp ObjectiveSet.cpp Surrogate.cpp EvaluationLog.cpp Metrics.cpp Trace.cpp Conformance.cpp SimBackend.cpp Pipeline.cpp Numa.cpp Arena.cpp cppSim.cpp latticeSim.cpp
 
 // TODO command line args
 // TODO air/water resistence
 
-OozebotEncoding gen(double duration) {
-    OozebotEncoding encoding = OozebotEncoding::randomEncoding();
-    OozebotEncoding::evaluate(encoding, duration);
-    return encoding;
+struct IntegratorComparison {
+    OozebotEncoding fixedStep;
+    OozebotEncoding symplectic;
+    double stepRatio; // fixed steps per symplectic step
+};
+
+IntegratorComparison compareIntegrators(OozebotEncoding &encoding, double duration, ContactModel contact) {
+    SimInputs inputs = OozebotEncoding::inputsFromEncoding(encoding);
+    double stepRatio = stableTimestep(inputs.points, inputs.springs, contact) / kDefaultTimestep;
+    OozebotEncoding fixedStep = encoding;
+    OozebotEncoding symplectic = encoding;
+    OozebotEncoding::evaluate(fixedStep, duration, eulerIntegrator);
+    OozebotEncoding::evaluate(symplectic, duration, symplecticIntegrator, contact);
+    return { fixedStep, symplectic, stepRatio };
 }
 
-std::pair<OozebotEncoding, int> hill(OozebotEncoding &encoding, double duration, int popIndex) {
-    OozebotEncoding newEncoding = mutate(encoding);
-    newEncoding.id = newGlobalID();
-    OozebotEncoding::evaluate(newEncoding, duration);
-    return { newEncoding, popIndex };
+// Evaluates random robots with both integrators and reports whether the larger per-robot steps keep fitness rankings
+void validateTimestepRankings(int numEncodings, double duration, ContactModel contact) {
+    std::vector<IntegratorComparison> comparisons;
+    std::future<IntegratorComparison> threads[NUM_THREADS];
+    int numStarted = 0;
+    while (comparisons.size() < numEncodings) {
+        int batchSize = std::min(NUM_THREADS, numEncodings - numStarted);
+        for (int i = 0; i < batchSize; i++) {
+            threads[i] = std::async(&compareIntegrators, OozebotEncoding::randomEncoding(), duration, contact);
+        }
+        for (int i = 0; i < batchSize; i++) {
+            comparisons.push_back(threads[i].get());
+        }
+        numStarted += batchSize;
+    }
+
+    std::vector<double> fixedFitness, symplecticFitness, fixedLengthAdj, symplecticLengthAdj;
+    double totalStepRatio = 0;
+    for (auto it = comparisons.begin(); it != comparisons.end(); ++it) {
+        fixedFitness.push_back((*it).fixedStep.fitness);
+        symplecticFitness.push_back((*it).symplectic.fitness);
+        fixedLengthAdj.push_back((*it).fixedStep.lengthAdj);
+        symplecticLengthAdj.push_back((*it).symplectic.lengthAdj);
+        totalStepRatio += (*it).stepRatio;
+    }
+    printf("Fitness rank correlation: %f\n", rankCorrelation(fixedFitness, symplecticFitness));
+    printf("Length adj rank correlation: %f\n", rankCorrelation(fixedLengthAdj, symplecticLengthAdj));
+    printf("Average steps saved: %fx\n", totalStepRatio / comparisons.size());
 }
 
 ParetoSelector runGenerations(double mutationRate, int generationSize, int numEvaluations, double duration, std::vector<OozebotEncoding> &initialPop, ParetoFront &globalFront) {
     ParetoSelector generation(generationSize, mutationRate);
     generation.globalParetoFront = &globalFront;
-    for (auto oozebot : initialPop) {
-        generation.insertOozebot(oozebot);
-    }
+    generation.insertOozebots(initialPop);
 
     int evaluationNumber = 0;
     while (evaluationNumber < numEvaluations) {
         evaluationNumber += generation.selectAndMate(duration);
         printf("Finished run #%d\n", evaluationNumber);
+        if (globalFront.surrogate != NULL) {
+            globalFront.surrogate->printStats();
+        }
+        simBackend().printCostStats();
     }
 
     return generation;
 }
 
+// Share of hill climbing spent only tuning controls - those children are simulated kControlLanes to a batch
+const double kControlTuningShare = 0.25;
+
+// kControlLanes control mutants of parent, scored together as one batch
+std::vector<OozebotEncoding> controlHillClimbStep(OozebotEncoding parent, double duration) {
+    std::vector<OozebotEncoding> children;
+    for (int i = 0; i < kControlLanes; i++) {
+        OozebotEncoding child = mutateControls(parent);
+        child.id = newGlobalID();
+        child.parentIds[0] = parent.id;
+        child.parentIds[1] = 0;
+        children.push_back(child);
+    }
+    evaluateControlVariants(children, duration);
+    return children;
+}
+
 ParetoSelector hillClimb(int numEvaluations, double duration, ParetoSelector &selector, ParetoFront& globalFront) {
     int popSize = selector.generation.size() / 2;
     std::vector<OozebotEncoding> initialPop;
@@ -52,27 +112,65 @@ ParetoSelector hillClimb(int numEvaluations, double duration, ParetoSelector &se
         initialPop.push_back(wrapper.encoding);
     }
 
-    std::future<std::pair<OozebotEncoding, int>> threads[NUM_THREADS];
-
-    int popIndex;
-    for (popIndex = 0; popIndex < NUM_THREADS; popIndex++) {
-        threads[popIndex] = std::async(&hill, initialPop[popIndex], duration, popIndex);
+    // Control tuning goes first. Each parent's batch runs on its own thread rather than through the sim backend, so
+    // only as many at a time as there are cores the backend's workers leave free
+    // The lanes don't record, so that would leave front entries to be simulated again for export
+    int numControlEvaluations = currentEvaluationConfig().recordTrajectory ? 0 : (int) (numEvaluations * kControlTuningShare);
+    numEvaluations -= numControlEvaluations;
+    const int numCores = std::max(1, (int) std::thread::hardware_concurrency());
+    int controlParent = 0;
+    while (numControlEvaluations > 0) {
+        // GPU workers mostly wait on the device, cpu ones each hold a core until their queue drains
+        int numThreads = numCores;
+        if (simBackend().kind == cpuBackend) {
+            numThreads = std::max(1, std::min(numCores, simBackend().idleWorkers()));
+        }
+        std::vector<int> parentIndices;
+        std::vector<std::future<std::vector<OozebotEncoding>>> threads;
+        while ((int) threads.size() < numThreads && numControlEvaluations > 0) {
+            parentIndices.push_back(controlParent);
+            threads.push_back(std::async(std::launch::async, &controlHillClimbStep, initialPop[controlParent], duration));
+            controlParent = (controlParent + 1) % initialPop.size();
+            numControlEvaluations -= kControlLanes;
+        }
+        for (int i = 0; i < (int) threads.size(); i++) {
+            std::vector<OozebotEncoding> children = threads[i].get();
+            for (auto it = children.begin(); it != children.end(); ++it) {
+                globalFront.evaluateEncoding(*it);
+                if (dominates(*it, initialPop[parentIndices[i]])) {
+                    initialPop[parentIndices[i]] = *it;
+                }
+            }
+        }
     }
 
-    int j = 0;
+    EvaluationPipeline pipeline(duration, &globalFront);
+    int popIndex = 0;
+    int numSubmitted = 0;
+    auto submitChild = [&]() {
+        OozebotEncoding parent = initialPop[popIndex];
+        pipeline.submit([parent]() {
+            OozebotEncoding child = mutate(parent);
+            child.id = newGlobalID();
+            child.parentIds[0] = parent.id;
+            child.parentIds[1] = 0;
+            return child;
+        }, popIndex);
+        popIndex = (popIndex + 1) % initialPop.size();
+        numSubmitted++;
+    };
+
+    while (numSubmitted < std::min(pipeline.outstandingLimit(), numEvaluations)) {
+        submitChild();
+    }
     for (int i = 0; i < numEvaluations; i++) {
-        auto pair = threads[j].get();
-        globalFront.evaluateEncoding(pair.first);
-        if (dominates(pair.first, initialPop[pair.second])) {
-            initialPop[pair.second] = pair.first;
+        int parentIndex;
+        OozebotEncoding child = pipeline.next(&parentIndex);
+        if (dominates(child, initialPop[parentIndex])) {
+            initialPop[parentIndex] = child;
         }
-
-        if (i < numEvaluations - 1) {
-            if (i < numEvaluations - NUM_THREADS) {
-                threads[j] = std::async(&hill, initialPop[popIndex], duration, popIndex);
-            }
-            j = (j + 1) % NUM_THREADS;
-            popIndex = (popIndex + 1) % initialPop.size();
+        if (numSubmitted < numEvaluations) {
+            submitChild();
         }
         if (i != 0 && i % initialPop.size() == 0) {
             printf("Finished run #%d\n", i);
@@ -81,9 +179,7 @@ ParetoSelector hillClimb(int numEvaluations, double duration, ParetoSelector &se
 
     ParetoSelector generation(initialPop.size(), 0);
     generation.globalParetoFront = &globalFront;
-    for (auto oozebot : initialPop) {
-        generation.insertOozebot(oozebot);
-    }
+    generation.insertOozebots(initialPop);
 
     return generation;
 }
@@ -92,23 +188,19 @@ ParetoSelector runRandomSearch(int numEvaluations, int generationSize, double du
     ParetoSelector generation(generationSize, 0);
     generation.globalParetoFront = &globalFront;
 
-    std::future<OozebotEncoding> threads[NUM_THREADS];
-
-    for (int i = 0; i < NUM_THREADS; i++) {
-        threads[i] = std::async(&gen, duration);
+    // Random search isn't screened but it's the surrogate's best training data
+    EvaluationPipeline pipeline(duration, &globalFront);
+    int numSubmitted = 0;
+    while (numSubmitted < std::min(pipeline.outstandingLimit(), numEvaluations)) {
+        pipeline.submit(&OozebotEncoding::randomEncoding, 0, false);
+        numSubmitted++;
     }
-    
-    int j = 0;
     for (int i = 0; i < numEvaluations; i++) {
-        OozebotEncoding encoding = threads[j].get();
-        globalFront.evaluateEncoding(encoding);
+        OozebotEncoding encoding = pipeline.next();
         generation.insertOozebot(encoding);
-
-        if (i < numEvaluations - 1) {
-            if (i < numEvaluations - NUM_THREADS) {
-                threads[j] = std::async(&gen, duration);
-            }
-            j = (j + 1) % NUM_THREADS;
+        if (numSubmitted < numEvaluations) {
+            pipeline.submit(&OozebotEncoding::randomEncoding, 0, false);
+            numSubmitted++;
         }
         if (i != 0 && i % generationSize == 0) {
             printf("Finished run #%d\n", i);
@@ -155,9 +247,89 @@ int main() {
     const int numEvaluationsPerGeneration = 10000; // TODO take as a param
     const int generationSize = 500; // TODO take as a param
     double mutationRate = 0.2; // TODO take as a param
+    const bool validateTimestep = false; // TODO take as a param
+    const bool useSurrogate = false; // skip simulating children a k-NN model predicts are far behind the front
+    const bool logEvaluations = false; // every robot's genome and result to output/evaluations.bin
+    const int metricsPort = 0; // serve live metrics on 127.0.0.1 when non-zero, e.g. 9464
+    const bool traceWorkers = false; // timeline of every thread to output/trace.json - open in ui.perfetto.dev
+    const bool checkEngines = false; // compares every engine against the committed conformance goldens
+    const bool regenerateGoldens = false; // rewrites the goldens from the cpu engine - only after deliberately changing the physics
+    const int cudaWorkers = 0; // robots on the GPU at once - 0 simulates everything on the cpu backend
+    const bool numaAware = false; // pin cpu workers to NUMA nodes, each node working its own queue
+    const bool useLattice = false; // evolve on the lattice-native engine instead of the spring arrays
+    const bool recordTrajectories = false; // front entries are exported from what evaluation saw, not simulated again
+
+    if (validateTimestep) {
+        validateTimestepRankings(200, 4.5, penaltyContact);
+        validateTimestepRankings(200, 4.5, constraintContact);
+        return 0;
+    }
+
+    if (cudaWorkers > 0) {
+        useSimBackend(createSimBackend(cudaBackend, cudaWorkers));
+    } else if (numaAware) {
+        std::vector<NumaNode> nodes = numaTopology();
+        int numCpus = 0;
+        for (auto it = nodes.begin(); it != nodes.end(); ++it) {
+            printf("NUMA node %d: %d cpus\n", (*it).id, (int) (*it).cpus.size());
+            numCpus += (int) (*it).cpus.size();
+        }
+        useSimBackend(createSimBackend(cpuBackend, numCpus, nodes));
+    }
+
+    EvaluationConfig evaluationConfig = kDefaultEvaluationConfig;
+    evaluationConfig.useLattice = useLattice;
+    evaluationConfig.recordTrajectory = recordTrajectories;
+    configureEvaluation(evaluationConfig);
+
+    if (checkEngines) {
+        std::vector<ConformanceEngine> engines = conformanceEngines(false);
+        std::vector<ConformanceGolden> goldens;
+        if (regenerateGoldens) {
+            printf("Generating goldens\n");
+            goldens = generateConformanceGoldens(256, 4.5, engines[0]);
+            writeConformanceGoldens(kConformanceGoldenPath, goldens);
+        } else if (!readConformanceGoldens(kConformanceGoldenPath, goldens)) {
+            printf("Couldn't read %s - run from VSOoze\n", kConformanceGoldenPath);
+            return 1;
+        }
+        bool passed = checkSlidingFriction();
+        for (auto it = engines.begin(); it != engines.end(); ++it) {
+            ConformanceReport report = checkConformance(*it, goldens);
+            printConformanceReport(report);
+            passed = passed && report.passed;
+        }
+        return passed ? 0 : 1;
+    }
+
+    if (traceWorkers) {
+        enableTracing();
+    }
+    if (metricsPort != 0) {
+        setGauge(workerSlotsGauge, simBackend().numWorkers);
+        startMetricsServer(metricsPort);
+    }
 
     ParetoFront globalFront;
+    Surrogate surrogate(kDefaultSurrogateConfig);
+    if (useSurrogate) {
+        globalFront.surrogate = &surrogate;
+    }
+    EvaluationLog evaluationLog;
+    if (logEvaluations) {
+        evaluationLog = createEvaluationLog("output/evaluations.bin");
+        globalFront.evaluationLog = &evaluationLog;
+    }
     ParetoSelector generation = runRecursive(mutationRate, generationSize, numEvaluationsPerGeneration, 4.5, 5, globalFront);
+    if (useSurrogate) {
+        surrogate.printStats();
+    }
+    if (logEvaluations) {
+        closeEvaluationLog(evaluationLog);
+    }
+    if (traceWorkers) {
+        writeTrace("output/trace.json");
+    }
 
     return 0;
 }
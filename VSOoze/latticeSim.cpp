@@ -0,0 +1,421 @@
+#include "latticeSim.h"
+#include "cppSim.h"
+#include <algorithm>
+#include <math.h>
+
+const float kLatticeSpacing = 0.1f; // meters between neighbouring nodes
+// Runs of springs are short (a few nodes along z) so nearby runs are merged and the gaps are computed as masked
+// out springs - cheaper than the loop overhead of many tiny runs
+const int kMaxSpringSpanGap = 8;
+
+// Rest lengths indexed by squared lattice distance - edge, face diagonal, body diagonal
+const float kLatticeRestLengths[4] = {0, kLatticeSpacing, kLatticeSpacing * 1.41421356f, kLatticeSpacing * 1.73205081f};
+
+// Forward neighbour offsets - must match the order of the template dispatch in simulateLattice
+const int kLatticeDirections[kNumLatticeDirections][3] = {
+    {0, 0, 1},
+    {0, 1, -1}, {0, 1, 0}, {0, 1, 1},
+    {1, -1, -1}, {1, -1, 0}, {1, -1, 1},
+    {1, 0, -1}, {1, 0, 0}, {1, 0, 1},
+    {1, 1, -1}, {1, 1, 0}, {1, 1, 1},
+};
+
+int latticeDirectionIndex(int dx, int dy, int dz) {
+    for (int i = 0; i < kNumLatticeDirections; i++) {
+        if (kLatticeDirections[i][0] == dx && kLatticeDirections[i][1] == dy && kLatticeDirections[i][2] == dz) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void appendToSpans(std::vector<LatticeSpan> &spans, int index, int maxGap) {
+    if (!spans.empty() && spans.back().start + spans.back().length + maxGap >= index) {
+        spans.back().length = index - spans.back().start + 1;
+    } else {
+        spans.push_back({index, 1});
+    }
+}
+
+LatticeRobot createLatticeRobot(std::vector<LatticeVoxel> &voxels, std::vector<LatticeMaterial> &materials, int groundOffsetY) {
+    int minX = 0, minY = 0, minZ = 0, maxX = 0, maxY = 0, maxZ = 0;
+    for (auto it = voxels.begin(); it != voxels.end(); ++it) {
+        if (it == voxels.begin()) {
+            minX = maxX = (*it).x;
+            minY = maxY = (*it).y;
+            minZ = maxZ = (*it).z;
+        }
+        minX = std::min(minX, (*it).x);
+        minY = std::min(minY, (*it).y);
+        minZ = std::min(minZ, (*it).z);
+        maxX = std::max(maxX, (*it).x);
+        maxY = std::max(maxY, (*it).y);
+        maxZ = std::max(maxZ, (*it).z);
+    }
+
+    LatticeRobot robot;
+    // A block at lattice coordinate c covers the nodes c and c + 1
+    robot.nx = maxX - minX + 2;
+    robot.ny = maxY - minY + 2;
+    robot.nz = maxZ - minZ + 2;
+    robot.materials = materials;
+    const int numNodes = robot.nx * robot.ny * robot.nz;
+    robot.mass.assign(numNodes, 0);
+    robot.uk.assign(numNodes, 0);
+    robot.us.assign(numNodes, 0);
+    for (int d = 0; d < kNumLatticeDirections; d++) {
+        robot.springMaterial[d].assign(numNodes, 0);
+    }
+
+    for (auto it = voxels.begin(); it != voxels.end(); ++it) {
+        LatticeMaterial material = materials[(*it).material];
+        int corners[8][3];
+        int c = 0;
+        for (int xi = 0; xi < 2; xi++) {
+            for (int yi = 0; yi < 2; yi++) {
+                for (int zi = 0; zi < 2; zi++) {
+                    corners[c][0] = (*it).x - minX + xi;
+                    corners[c][1] = (*it).y - minY + yi;
+                    corners[c][2] = (*it).z - minZ + zi;
+                    const int node = (corners[c][0] * robot.ny + corners[c][1]) * robot.nz + corners[c][2];
+                    if (robot.mass[node] == 0) {
+                        robot.mass[node] = material.kg;
+                        robot.uk[node] = material.uk;
+                        robot.us[node] = material.us;
+                    }
+                    c++;
+                }
+            }
+        }
+        // The corners are in x -> y -> z order so the first of each pair is always the lower node
+        for (int a = 0; a < 8; a++) {
+            for (int b = a + 1; b < 8; b++) {
+                const int direction = latticeDirectionIndex(corners[b][0] - corners[a][0], corners[b][1] - corners[a][1], corners[b][2] - corners[a][2]);
+                const int node = (corners[a][0] * robot.ny + corners[a][1]) * robot.nz + corners[a][2];
+                if (robot.springMaterial[direction][node] == 0) {
+                    robot.springMaterial[direction][node] = (unsigned char) ((*it).material + 1);
+                }
+            }
+        }
+    }
+
+    robot.x.assign(numNodes, 0);
+    robot.y.assign(numNodes, 0);
+    robot.z.assign(numNodes, 0);
+    robot.vx.assign(numNodes, 0);
+    robot.vy.assign(numNodes, 0);
+    robot.vz.assign(numNodes, 0);
+    robot.fx.assign(numNodes, 0);
+    robot.fy.assign(numNodes, 0);
+    robot.fz.assign(numNodes, 0);
+    float smallest[3] = {100, 100, 100};
+    float largest[3] = {-100, -100, -100};
+    for (int xi = 0; xi < robot.nx; xi++) {
+        for (int yi = 0; yi < robot.ny; yi++) {
+            for (int zi = 0; zi < robot.nz; zi++) {
+                const int node = (xi * robot.ny + yi) * robot.nz + zi;
+                // Same float arithmetic as layBlockAtPosition so both engines start from identical positions
+                robot.x[node] = (xi + minX) / 10.0f;
+                robot.y[node] = (yi + minY) / 10.0f;
+                robot.z[node] = (zi + minZ) / 10.0f;
+                robot.y[node] -= (float) (double(groundOffsetY) / 10.0);
+                if (robot.mass[node] == 0) {
+                    continue;
+                }
+                appendToSpans(robot.nodeSpans, node, 0);
+                smallest[0] = std::min(robot.x[node], smallest[0]);
+                smallest[1] = std::min(robot.y[node], smallest[1]);
+                smallest[2] = std::min(robot.z[node], smallest[2]);
+                largest[0] = std::max(robot.x[node], largest[0]);
+                largest[1] = std::max(robot.y[node], largest[1]);
+                largest[2] = std::max(robot.z[node], largest[2]);
+            }
+        }
+    }
+    robot.length = (double) std::max(std::max(largest[0] - smallest[0], largest[1] - smallest[1]), largest[2] - smallest[2]);
+
+    int longestSpan = 0;
+    for (int d = 0; d < kNumLatticeDirections; d++) {
+        for (int node = 0; node < numNodes; node++) {
+            if (robot.springMaterial[d][node] != 0) {
+                appendToSpans(robot.springSpans[d], node, kMaxSpringSpanGap);
+            }
+        }
+        for (auto it = robot.springSpans[d].begin(); it != robot.springSpans[d].end(); ++it) {
+            longestSpan = std::max(longestSpan, (*it).length);
+        }
+    }
+    robot.scratch.assign(longestSpan * 3, 0);
+    return robot;
+}
+
+// Forces for one run of springs along a neighbour direction - only reads positions so it vectorizes.
+// Returns non-zero if any spring in the run is torn apart
+template <int DX, int DY, int DZ>
+int latticeSpanForces(
+    const float * __restrict x,
+    const float * __restrict y,
+    const float * __restrict z,
+    const unsigned char * __restrict material,
+    const float * __restrict materialK,
+    const float * __restrict materialAdjust,
+    float * __restrict dxs,
+    float * __restrict dys,
+    float * __restrict dzs,
+    int stride,
+    int length,
+    float maxStretch) {
+    const float l0 = kLatticeRestLengths[DX * DX + DY * DY + DZ * DZ];
+    const float maxDist = l0 * maxStretch;
+    int invalid = 0;
+    for (int s = 0; s < length; s++) {
+        const float xd = x[s] - x[s + stride];
+        const float yd = y[s] - y[s + stride];
+        const float zd = z[s] - z[s + stride];
+        const float dist = sqrt(xd * xd + yd * yd + zd * zd);
+        const int m = material[s];
+        invalid |= (m != 0) & (dist > maxDist);
+
+        // negative if repelling, positive if attracting - material 0 has k = 0 and the + 1 keeps it from dividing by 0
+        const float f = materialK[m] * (dist - (l0 * materialAdjust[m]));
+        const float fd = f / (dist + (m == 0));
+        dxs[s] = xd * fd;
+        dys[s] = yd * fd;
+        dzs[s] = zd * fd;
+    }
+    return invalid;
+}
+
+// When the run is shorter than the stride its two endpoint ranges don't overlap, so forces can be applied in the
+// same pass without a loop carried dependency
+template <int DX, int DY, int DZ>
+int latticeSpanForcesFused(
+    const float * __restrict x,
+    const float * __restrict y,
+    const float * __restrict z,
+    const unsigned char * __restrict material,
+    const float * __restrict materialK,
+    const float * __restrict materialAdjust,
+    float * __restrict fxLow,
+    float * __restrict fyLow,
+    float * __restrict fzLow,
+    float * __restrict fxHigh,
+    float * __restrict fyHigh,
+    float * __restrict fzHigh,
+    int stride,
+    int length,
+    float maxStretch) {
+    const float l0 = kLatticeRestLengths[DX * DX + DY * DY + DZ * DZ];
+    const float maxDist = l0 * maxStretch;
+    int invalid = 0;
+    for (int s = 0; s < length; s++) {
+        const float xd = x[s] - x[s + stride];
+        const float yd = y[s] - y[s + stride];
+        const float zd = z[s] - z[s + stride];
+        const float dist = sqrt(xd * xd + yd * yd + zd * zd);
+        const int m = material[s];
+        invalid |= (m != 0) & (dist > maxDist);
+
+        const float f = materialK[m] * (dist - (l0 * materialAdjust[m]));
+        const float fd = f / (dist + (m == 0));
+        const float dx = xd * fd;
+        const float dy = yd * fd;
+        const float dz = zd * fd;
+        fxLow[s] -= dx;
+        fyLow[s] -= dy;
+        fzLow[s] -= dz;
+        fxHigh[s] += dx;
+        fyHigh[s] += dy;
+        fzHigh[s] += dz;
+    }
+    return invalid;
+}
+
+void scatterSpanForces(float * __restrict f, const float * __restrict d, int length, float sign) {
+    for (int s = 0; s < length; s++) {
+        f[s] += sign * d[s];
+    }
+}
+
+// Spring forces along one neighbour direction. Runs longer than the stride are split into a pass that only reads
+// positions and passes that scatter into either endpoint, so none of the loops carry a dependency
+template <int DX, int DY, int DZ>
+bool updateLatticeDirection(LatticeRobot &robot, int direction, const float *materialK, const float *materialAdjust, float maxStretch) {
+    const int stride = (DX * robot.ny + DY) * robot.nz + DZ;
+    const unsigned char *material = robot.springMaterial[direction].data();
+    const int scratchSize = (int) robot.scratch.size() / 3;
+    float *dxs = robot.scratch.data();
+    float *dys = dxs + scratchSize;
+    float *dzs = dys + scratchSize;
+
+    for (auto it = robot.springSpans[direction].begin(); it != robot.springSpans[direction].end(); ++it) {
+        const int start = (*it).start;
+        const int length = (*it).length;
+        if (length <= stride) {
+            const int invalid = latticeSpanForcesFused<DX, DY, DZ>(
+                &robot.x[start], &robot.y[start], &robot.z[start], &material[start], materialK, materialAdjust,
+                &robot.fx[start], &robot.fy[start], &robot.fz[start], &robot.fx[start + stride], &robot.fy[start + stride], &robot.fz[start + stride],
+                stride, length, maxStretch);
+            if (invalid) {
+                return false;
+            }
+            continue;
+        }
+        const int invalid = latticeSpanForces<DX, DY, DZ>(
+            &robot.x[start], &robot.y[start], &robot.z[start], &material[start], materialK, materialAdjust, dxs, dys, dzs, stride, length, maxStretch);
+        if (invalid) {
+            return false;
+        }
+        scatterSpanForces(&robot.fx[start], dxs, length, -1);
+        scatterSpanForces(&robot.fy[start], dys, length, -1);
+        scatterSpanForces(&robot.fz[start], dzs, length, -1);
+        scatterSpanForces(&robot.fx[start + stride], dxs, length, 1);
+        scatterSpanForces(&robot.fy[start + stride], dys, length, 1);
+        scatterSpanForces(&robot.fz[start + stride], dzs, length, 1);
+    }
+    return true;
+}
+
+bool simulateLattice(LatticeRobot &robot, std::vector<FlexPreset> &presets, double n, double t, float oscillationFrequency, SimOptions options) {
+    const float dt = options.dt;
+    const float stepDampening = stepDampeningForOptions(options);
+    const PhysicsParameters &physics = options.physics;
+    const bool penalty = options.contact == penaltyContact;
+
+    // Indexed by material byte, 0 is "no spring" and never read
+    std::vector<float> materialK(robot.materials.size() + 1, 0);
+    std::vector<float> materialAdjust(robot.materials.size() + 1, 1);
+    for (int m = 0; m < robot.materials.size(); m++) {
+        materialK[m + 1] = robot.materials[m].k;
+    }
+
+    while (t < n) {
+        for (int m = 0; m < robot.materials.size(); m++) {
+            const FlexPreset preset = presets[robot.materials[m].flexIndex];
+            materialAdjust[m + 1] = preset.a * (1 + preset.b * sin(t * oscillationFrequency + preset.c));
+        }
+        const float *k = materialK.data();
+        const float *adjust = materialAdjust.data();
+        bool valid = updateLatticeDirection<0, 0, 1>(robot, 0, k, adjust, physics.maxStretch)
+            && updateLatticeDirection<0, 1, -1>(robot, 1, k, adjust, physics.maxStretch)
+            && updateLatticeDirection<0, 1, 0>(robot, 2, k, adjust, physics.maxStretch)
+            && updateLatticeDirection<0, 1, 1>(robot, 3, k, adjust, physics.maxStretch)
+            && updateLatticeDirection<1, -1, -1>(robot, 4, k, adjust, physics.maxStretch)
+            && updateLatticeDirection<1, -1, 0>(robot, 5, k, adjust, physics.maxStretch)
+            && updateLatticeDirection<1, -1, 1>(robot, 6, k, adjust, physics.maxStretch)
+            && updateLatticeDirection<1, 0, -1>(robot, 7, k, adjust, physics.maxStretch)
+            && updateLatticeDirection<1, 0, 0>(robot, 8, k, adjust, physics.maxStretch)
+            && updateLatticeDirection<1, 0, 1>(robot, 9, k, adjust, physics.maxStretch)
+            && updateLatticeDirection<1, 1, -1>(robot, 10, k, adjust, physics.maxStretch)
+            && updateLatticeDirection<1, 1, 0>(robot, 11, k, adjust, physics.maxStretch)
+            && updateLatticeDirection<1, 1, 1>(robot, 12, k, adjust, physics.maxStretch);
+        if (!valid) {
+            return false;
+        }
+
+        for (auto it = robot.nodeSpans.begin(); it != robot.nodeSpans.end(); ++it) {
+            const int end = (*it).start + (*it).length;
+            for (int i = (*it).start; i < end; i++) {
+                const float mass = robot.mass[i];
+                const float y = robot.y[i];
+                float fy = robot.fy[i] + physics.gravity * mass;
+                float fx = robot.fx[i];
+                float fz = robot.fz[i];
+
+                if (penalty && y <= 0) {
+                    const float fh = sqrt(fx * fx + fz * fz);
+                    const float fyfric = abs(fy * robot.us[i]);
+                    if (fh < fyfric) {
+                        fx = 0;
+                        fz = 0;
+                    } else {
+                        const float fykinetic = abs(fy * robot.uk[i]) / fh;
+                        fx = fx - fx * fykinetic;
+                        fz = fz - fz * fykinetic;
+                    }
+                    fy += physics.groundStiffness * y;
+                }
+                // reset the force cache
+                robot.fx[i] = 0;
+                robot.fy[i] = 0;
+                robot.fz[i] = 0;
+                float vx = (fx / mass * dt + robot.vx[i]) * stepDampening;
+                float vy = (fy / mass * dt + robot.vy[i]) * stepDampening;
+                float vz = (fz / mass * dt + robot.vz[i]) * stepDampening;
+                float px = robot.x[i] + vx * dt;
+                float py = robot.y[i] + vy * dt;
+                float pz = robot.z[i] + vz * dt;
+
+                if (!penalty && py < 0) {
+                    // Same resolution as resolveGroundConstraints
+                    const float jn = vy < 0 ? -vy : 0;
+                    py = 0;
+                    vy += jn;
+                    const float vh = sqrt(vx * vx + vz * vz);
+                    float scale = 0;
+                    if (vh > robot.us[i] * jn) {
+                        scale = std::max(0.0f, 1 - robot.uk[i] * jn / vh);
+                    }
+                    const float dvx = vx * (scale - 1);
+                    const float dvz = vz * (scale - 1);
+                    vx += dvx;
+                    vz += dvz;
+                    px += dvx * dt;
+                    pz += dvz * dt;
+                }
+                robot.vx[i] = vx;
+                robot.vy[i] = vy;
+                robot.vz[i] = vz;
+                robot.x[i] = px;
+                robot.y[i] = py;
+                robot.z[i] = pz;
+            }
+        }
+        t += dt;
+    }
+    return true;
+}
+
+float latticeStableTimestep(LatticeRobot &robot, ContactModel contact, PhysicsParameters physics) {
+    std::vector<double> stiffness(robot.mass.size(), 0.0);
+    for (int d = 0; d < kNumLatticeDirections; d++) {
+        const int stride = (kLatticeDirections[d][0] * robot.ny + kLatticeDirections[d][1]) * robot.nz + kLatticeDirections[d][2];
+        for (auto it = robot.springSpans[d].begin(); it != robot.springSpans[d].end(); ++it) {
+            for (int i = (*it).start; i < (*it).start + (*it).length; i++) {
+                if (robot.springMaterial[d][i] == 0) {
+                    continue;
+                }
+                const float k = robot.materials[robot.springMaterial[d][i] - 1].k;
+                stiffness[i] += k;
+                stiffness[i + stride] += k;
+            }
+        }
+    }
+    double maxOmegaSquared = 0;
+    for (auto it = robot.nodeSpans.begin(); it != robot.nodeSpans.end(); ++it) {
+        for (int i = (*it).start; i < (*it).start + (*it).length; i++) {
+            maxOmegaSquared = std::max(maxOmegaSquared, pointOmegaSquared(stiffness[i], robot.mass[i], contact, physics));
+        }
+    }
+    return timestepForOmegaSquared(maxOmegaSquared);
+}
+
+void latticeToPoints(LatticeRobot &robot, std::vector<Point> &points) {
+    points.clear();
+    for (auto it = robot.nodeSpans.begin(); it != robot.nodeSpans.end(); ++it) {
+        for (int i = (*it).start; i < (*it).start + (*it).length; i++) {
+            Point p = {robot.x[i], robot.y[i], robot.z[i], robot.vx[i], robot.vy[i], robot.vz[i], robot.mass[i], robot.uk[i], robot.us[i], 0, 0, 0, 0, 0};
+            points.push_back(p);
+        }
+    }
+}
+
+size_t latticeSpringCount(LatticeRobot &robot) {
+    size_t count = 0;
+    for (int d = 0; d < kNumLatticeDirections; d++) {
+        for (auto it = robot.springMaterial[d].begin(); it != robot.springMaterial[d].end(); ++it) {
+            count += *it != 0;
+        }
+    }
+    return count;
+}
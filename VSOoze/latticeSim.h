@@ -0,0 +1,64 @@
+#ifndef LATTICE_SIM_H
+#define LATTICE_SIM_H
+
+#include <vector>
+#include "cudaSim.h"
+
+// Half of the 26 lattice neighbours - every spring is owned by its lower node in x -> y -> z order
+const int kNumLatticeDirections = 13;
+
+struct LatticeVoxel {
+    int x; // lattice coordinate of the block's lowest corner
+    int y;
+    int z;
+    int material; // index into the materials passed alongside
+};
+
+struct LatticeMaterial {
+    float kg; // mass of each point the block owns
+    float uk; // kinetic friction coefficient
+    float us; // static friction coefficient
+    float k; // N/m for each spring the block owns
+    int flexIndex;
+};
+
+struct LatticeSpan {
+    int start; // first node index
+    int length;
+};
+
+// Points live on the nodes of a dense grid around the robot, stored as structure of arrays.
+// Springs aren't stored - a node has one in a direction iff its material byte for that direction is set
+struct LatticeRobot {
+    int nx; // nodes along each axis
+    int ny;
+    int nz;
+    std::vector<float> x, y, z;
+    std::vector<float> vx, vy, vz;
+    std::vector<float> fx, fy, fz;
+    std::vector<float> mass, uk, us; // mass is 0 for empty nodes
+    std::vector<unsigned char> springMaterial[kNumLatticeDirections]; // 0 for no spring, otherwise material index + 1
+    std::vector<LatticeSpan> springSpans[kNumLatticeDirections]; // runs of nodes with springs in that direction, small gaps included
+    std::vector<LatticeSpan> nodeSpans; // runs of consecutive occupied nodes
+    std::vector<LatticeMaterial> materials;
+    std::vector<float> scratch; // per-spring forces for the span being processed
+    double length;
+};
+
+// Voxels are in lay order - when two blocks share a point or spring the earlier one decides its material.
+// groundOffsetY is the lowest lattice y so the robot starts resting on the ground
+LatticeRobot createLatticeRobot(std::vector<LatticeVoxel> &voxels, std::vector<LatticeMaterial> &materials, int groundOffsetY);
+
+// Same contract as simulateAgainCPP - returns false if a spring is torn apart
+bool simulateLattice(LatticeRobot &robot, std::vector<FlexPreset> &presets, double n, double t, float oscillationFrequency, SimOptions options = kDefaultSimOptions);
+
+// stableTimestep for a lattice robot
+float latticeStableTimestep(LatticeRobot &robot, ContactModel contact = penaltyContact, PhysicsParameters physics = kDefaultPhysics);
+
+// Copies the occupied nodes out as points, in node order
+void latticeToPoints(LatticeRobot &robot, std::vector<Point> &points);
+
+// How many springs the same robot has as spring arrays - what simulation time scales with
+size_t latticeSpringCount(LatticeRobot &robot);
+
+#endif